@@ -0,0 +1,181 @@
+#ifndef BLOCK_PIPELINE_H
+#define BLOCK_PIPELINE_H
+
+// Runs a producer and a consumer against a BlockRing.
+// ESP32:      producer runs as a FreeRTOS task on the other core
+// ESP8266:    single core, producer and consumer take turns in bursts
+// host build: producer runs on a std::thread
+// A mode can be forced by defining it, the host tests run the bursts too.
+
+#include "BlockRing.h"
+
+#if !defined(BLOCK_PIPELINE_TASKS) && !defined(BLOCK_PIPELINE_COOPERATIVE) && !defined(BLOCK_PIPELINE_THREADS)
+	#if defined(ESP32)
+		#define BLOCK_PIPELINE_TASKS
+	#elif defined(ARDUINO)
+		#define BLOCK_PIPELINE_COOPERATIVE
+	#else
+		#define BLOCK_PIPELINE_THREADS
+	#endif
+#endif
+
+#if defined(BLOCK_PIPELINE_TASKS)
+	#include <freertos/FreeRTOS.h>
+	#include <freertos/task.h>
+#elif defined(BLOCK_PIPELINE_THREADS)
+	#include <thread>
+#endif
+
+#ifndef BLOCK_PIPELINE_STACK
+	#define BLOCK_PIPELINE_STACK	4096
+#endif
+#ifndef BLOCK_PIPELINE_PRIORITY
+	#define BLOCK_PIPELINE_PRIORITY	1
+#endif
+#ifndef BLOCK_PIPELINE_CORE
+	#define BLOCK_PIPELINE_CORE		0
+#endif
+
+
+template <class Ring>
+class BlockPipeline	{
+public:
+	// fill data with up to size bytes, return the number placed, 0 at end of data
+	typedef size_t (*Producer)(void *ctx, uint8_t *data, size_t size);
+	// drain length bytes from data, return false to abort the transfer
+	typedef bool (*Consumer)(void *ctx, const uint8_t *data, size_t length);
+
+	BlockPipeline(Ring *ring, Producer producer, Consumer consumer, void *ctx)
+		: ring(ring), producer(producer), consumer(consumer), ctx(ctx)	{
+		ring->reset();
+	}
+
+	// run to completion, false if the consumer aborted the transfer
+	bool run()	{
+#if defined(BLOCK_PIPELINE_TASKS)
+		producerExited = false;
+		if(xTaskCreatePinnedToCore(producerTask, "davpipe", BLOCK_PIPELINE_STACK, this, BLOCK_PIPELINE_PRIORITY, NULL, BLOCK_PIPELINE_CORE) != pdPASS)
+			return runCooperative();
+		bool retVal = consumerLoop();
+		while(!producerExited)
+			wait();
+		return retVal;
+#elif defined(BLOCK_PIPELINE_THREADS)
+		std::thread producerThread(&BlockPipeline::producerLoop, this);
+		bool retVal = consumerLoop();
+		producerThread.join();
+		return retVal;
+#else
+		return runCooperative();
+#endif
+	}
+
+private:
+	typedef typename Ring::Block Block;
+
+	// single thread of control: fill the ring, then drain it
+	// a fill that ends on a full ring is a producer stall, it waits for the
+	// drain. The consumer only runs on a filled ring and never stalls here
+	bool runCooperative()	{
+		bool producing = true;
+		while(producing || !ring->isEmpty())	{
+			Block *blk;
+			while(producing && (blk = ring->producerSlot()))	{
+				if(!produce(blk))
+					producing = false;
+			}
+			if(producing)
+				ring->stats.producerStalls++;
+
+			while((blk = ring->consumerSlot()))	{
+				if(!consumer(ctx, blk->data, blk->length))
+					return false;
+				ring->consumerRelease();
+			}
+		}
+		return true;
+	}
+
+	// fill one block, false at end of data (ring is closed)
+	bool produce(Block *blk)	{
+		blk->length = producer(ctx, blk->data, Ring::blockSize);
+		if(blk->length == 0)	{
+			ring->close();
+			return false;
+		}
+		ring->producerCommit();
+		return true;
+	}
+
+	void producerLoop()	{
+		bool stalled = false;
+		while(!ring->isAborted())	{
+			Block *blk = ring->producerSlot();
+			if(!blk)	{
+				if(!stalled)
+					ring->stats.producerStalls++;
+				stalled = true;
+				wait();
+				continue;
+			}
+
+			stalled = false;
+			if(!produce(blk))
+				return;
+		}
+		ring->close();
+	}
+
+	bool consumerLoop()	{
+		bool stalled = false;
+		while(true)	{
+			Block *blk = ring->consumerSlot();
+			if(!blk)	{
+				// closed is checked before empty, a last block may slip in between
+				if(ring->isClosed())	{
+					if(ring->isEmpty())
+						return true;
+					continue;
+				}
+				if(!stalled)
+					ring->stats.consumerStalls++;
+				stalled = true;
+				wait();
+				continue;
+			}
+
+			stalled = false;
+			if(!consumer(ctx, blk->data, blk->length))	{
+				ring->abort();
+				return false;
+			}
+			ring->consumerRelease();
+		}
+	}
+
+#if defined(BLOCK_PIPELINE_TASKS)
+	static void producerTask(void *arg)	{
+		BlockPipeline *pipe = (BlockPipeline *) arg;
+		pipe->producerLoop();
+		pipe->producerExited = true;
+		vTaskDelete(NULL);
+	}
+
+	volatile bool producerExited;
+#endif
+
+	static void wait()	{
+#if defined(BLOCK_PIPELINE_TASKS)
+		vTaskDelay(1);
+#elif defined(BLOCK_PIPELINE_THREADS)
+		std::this_thread::yield();
+#endif
+	}
+
+	Ring *ring;
+	Producer producer;
+	Consumer consumer;
+	void *ctx;
+};
+
+#endif
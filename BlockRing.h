@@ -0,0 +1,115 @@
+#ifndef BLOCK_RING_H
+#define BLOCK_RING_H
+
+// Lock-free single producer / single consumer ring of fixed size data blocks.
+// Plain C++11, no Arduino dependencies, so it builds on the host as well.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+
+// each counter is written by one side only, read once the transfer is over
+// stalls count episodes of waiting, not polls
+struct BlockRingStats	{
+	uint32_t blocks;
+	uint32_t producerStalls;	// producer found the ring full
+	uint32_t consumerStalls;	// consumer found the ring empty
+};
+
+
+template <size_t BLOCK_SIZE, size_t DEPTH>
+class BlockRing	{
+public:
+	struct Block	{
+		alignas(4) uint8_t data[BLOCK_SIZE];
+		size_t length;
+	};
+
+	static const size_t blockSize = BLOCK_SIZE;
+	static const size_t depth = DEPTH;
+
+	BlockRing()	{
+		reset();
+	}
+
+	void reset()	{
+		head.store(0, std::memory_order_relaxed);
+		tail.store(0, std::memory_order_relaxed);
+		closed.store(false, std::memory_order_relaxed);
+		aborted.store(false, std::memory_order_relaxed);
+		stats.blocks = stats.producerStalls = stats.consumerStalls = 0;
+	}
+
+	// ---- producer side
+	// returns the next free block or NULL if the ring is full
+	Block *producerSlot()	{
+		size_t h = head.load(std::memory_order_relaxed);
+		if(h - tail.load(std::memory_order_acquire) == DEPTH)
+			return NULL;
+		return &blocks[h % DEPTH];
+	}
+
+	// publish the block returned by producerSlot
+	void producerCommit()	{
+		head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+		stats.blocks++;
+	}
+
+	// no more blocks will be produced
+	void close()	{
+		closed.store(true, std::memory_order_release);
+	}
+
+	// ---- consumer side
+	// returns the oldest filled block or NULL if the ring is empty
+	Block *consumerSlot()	{
+		size_t t = tail.load(std::memory_order_relaxed);
+		if(head.load(std::memory_order_acquire) == t)
+			return NULL;
+		return &blocks[t % DEPTH];
+	}
+
+	// hand the block returned by consumerSlot back to the producer
+	void consumerRelease()	{
+		tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+	// consumer gave up, producer should stop
+	void abort()	{
+		aborted.store(true, std::memory_order_release);
+	}
+
+	// ---- either side
+	bool isClosed()	{
+		return closed.load(std::memory_order_acquire);
+	}
+
+	bool isAborted()	{
+		return aborted.load(std::memory_order_acquire);
+	}
+
+	bool isEmpty()	{
+		return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+	}
+
+	bool isFull()	{
+		return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire) == DEPTH;
+	}
+
+	// finished: producer closed the ring and the consumer drained it
+	bool isDone()	{
+		return isClosed() && isEmpty();
+	}
+
+	BlockRingStats stats;
+
+private:
+	Block blocks[DEPTH];
+	std::atomic<size_t> head;
+	std::atomic<size_t> tail;
+	std::atomic<bool> closed;
+	std::atomic<bool> aborted;
+};
+
+#endif
@@ -0,0 +1,187 @@
+#include <string.h>
+#include "BusArbiter.h"
+
+#if defined(ARDUINO)
+	#include <Arduino.h>
+	static uint32_t defaultClock()	{ return millis(); }
+	static void defaultSleep(uint32_t ms)	{ delay(ms); }
+#else
+	#include <chrono>
+	#include <thread>
+	static uint32_t defaultClock()	{
+		return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+	static void defaultSleep(uint32_t ms)	{ std::this_thread::sleep_for(std::chrono::milliseconds(ms)); }
+#endif
+
+// the chip select interrupt lands here
+#if defined(ESP8266)
+	#define BUS_ISR_ATTR	ICACHE_RAM_ATTR
+#elif defined(ESP32)
+	#define BUS_ISR_ATTR	IRAM_ATTR
+#else
+	#define BUS_ISR_ATTR
+#endif
+
+
+// ------------------------
+BusArbiter::BusArbiter() : busSwitch(NULL), now(defaultClock), sleep(defaultSleep), blockout(0),
+		held(false), edgeCount(0), seenEdges(0), activitySeen(false), lastActivity(0), leaseStart(0)	{
+// ------------------------
+	memset(&busStats, 0, sizeof(busStats));
+}
+
+
+
+// ------------------------
+void BusArbiter::begin(BusSwitch busSwitch, uint32_t blockoutMs)	{
+// ------------------------
+	this->busSwitch = busSwitch;
+	blockout = blockoutMs;
+	held = false;
+	edgeCount = seenEdges = 0;
+	activitySeen = false;
+	memset(&busStats, 0, sizeof(busStats));
+}
+
+
+
+// ------------------------
+void BusArbiter::setClock(Clock clock, Sleep sleep)	{
+// ------------------------
+	now = clock;
+	this->sleep = sleep;
+}
+
+
+
+// ------------------------
+void BUS_ISR_ATTR BusArbiter::otherMasterActive()	{
+// ------------------------
+	// our own chip select toggles the line as well
+	// volatile fields only, no calls out of IRAM
+	if(held)
+		return;
+	edgeCount++;
+}
+
+
+
+// ------------------------
+void BusArbiter::poll()	{
+// ------------------------
+	// edges counted since the last look date from now
+	uint32_t numEdges = edgeCount;
+	if(numEdges == seenEdges)
+		return;
+	seenEdges = numEdges;
+	lastActivity = now();
+	activitySeen = true;
+}
+
+
+
+// ------------------------
+bool BusArbiter::isBlocked()	{
+// ------------------------
+	poll();
+	return !held && activitySeen && now() - lastActivity < blockout;
+}
+
+
+
+// ------------------------
+uint32_t BusArbiter::retryAfter()	{
+// ------------------------
+	// whole seconds until the blockout ends, for Retry-After
+	poll();
+	uint32_t idle = now() - lastActivity;
+	uint32_t left = (activitySeen && idle < blockout) ? blockout - idle : 0;
+	return (left > 1000) ? (left + 999) / 1000 : 1;
+}
+
+
+
+// ------------------------
+bool BusArbiter::acquire(bool counted)	{
+// ------------------------
+	if(held)
+		return true;
+	if(isBlocked())	{
+		if(counted)
+			busStats.denied++;
+		return false;
+	}
+
+	take();
+	if(counted)
+		busStats.leases++;
+	return true;
+}
+
+
+
+// ------------------------
+void BusArbiter::release()	{
+// ------------------------
+	if(!held)
+		return;
+
+	if(busSwitch)
+		busSwitch(false);
+	held = false;
+
+	uint32_t holdMs = now() - leaseStart;
+	busStats.holdMs += holdMs;
+	if(holdMs > busStats.longestHoldMs)
+		busStats.longestHoldMs = holdMs;
+}
+
+
+
+// ------------------------
+bool BusArbiter::leaseExpired()	{
+// ------------------------
+	return held && now() - leaseStart >= DAV_BUS_LEASE;
+}
+
+
+
+// ------------------------
+bool BusArbiter::handOver()	{
+// ------------------------
+	// between bursts: the other master gets at least one gap, then as long
+	// as it keeps using the bus. false when it did not let go in time, the
+	// bus is not held then
+	uint32_t tStart = now();
+	release();
+	busStats.handOvers++;
+
+	sleep(DAV_BUS_GAP);
+	poll();
+	while(activitySeen && now() - lastActivity < DAV_BUS_QUIET)	{
+		if(now() - tStart >= DAV_BUS_WAIT)	{
+			busStats.lost++;
+			busStats.waitMs += now() - tStart;
+			return false;
+		}
+		sleep(1);
+		poll();
+	}
+
+	busStats.waitMs += now() - tStart;
+	take();
+	return true;
+}
+
+
+
+// ------------------------
+void BusArbiter::take()	{
+// ------------------------
+	// held first, the pins switching must not count as the other master
+	held = true;
+	leaseStart = now();
+	if(busSwitch)
+		busSwitch(true);
+}
@@ -0,0 +1,77 @@
+#ifndef BUS_ARBITER_H
+#define BUS_ARBITER_H
+
+// Shares the SD card's SPI bus with another master, e.g. a printer board.
+// The other master cannot ask for the bus, its chip select edges are all
+// that is seen. After one of them the bus is left alone for the blockout
+// period. Otherwise it is taken in leases: a long transfer hands the bus
+// over between block bursts once its lease is up, and resumes when the
+// other master has gone quiet again.
+// The interrupt only counts edges, their time is taken the next time the
+// arbiter looks, so poll() should run often, e.g. once per loop().
+// Clock and sleep can be replaced and the chip select line is a plain
+// call, so the timing can be driven on the host.
+
+#include <stddef.h>
+#include <stdint.h>
+#include "ESPWebDAVConfig.h"
+
+// counters since begin()
+struct BusStats	{
+	uint32_t leases;			// bus taken for a request
+	uint32_t denied;			// request turned away during a blockout
+	uint32_t handOvers;			// lease ended between bursts of a transfer
+	uint32_t lost;				// transfer gave up, the other master kept the bus
+	uint32_t edges;				// chip select edges from the other master
+	uint32_t holdMs;			// total time the bus was held
+	uint32_t longestHoldMs;		// longest single lease
+	uint32_t waitMs;			// total time transfers waited to resume
+};
+
+
+class BusArbiter	{
+public:
+	// take true: drive the bus pins, false: float them
+	typedef void (*BusSwitch)(bool take);
+	typedef uint32_t (*Clock)();
+	typedef void (*Sleep)(uint32_t ms);
+
+	BusArbiter();
+	void begin(BusSwitch busSwitch, uint32_t blockoutMs);
+	void setClock(Clock clock, Sleep sleep);
+
+	// chip select fell, safe to call from the interrupt
+	void otherMasterActive();
+	void poll();
+	bool isBlocked();
+	uint32_t retryAfter();
+
+	// counted is false for work that is not a request, e.g. the card start
+	bool acquire(bool counted = true);
+	void release();
+	bool isHeld()	{ return held; }
+	bool leaseExpired();
+	bool handOver();
+
+	const BusStats& stats()	{ busStats.edges = edgeCount; return busStats; }
+
+private:
+	void take();
+
+	BusSwitch busSwitch;
+	Clock now;
+	Sleep sleep;
+	uint32_t blockout;
+
+	// shared with the interrupt
+	volatile bool held;
+	volatile uint32_t edgeCount;
+
+	uint32_t seenEdges;
+	bool activitySeen;
+	uint32_t lastActivity;
+	uint32_t leaseStart;
+	BusStats busStats;
+};
+
+#endif
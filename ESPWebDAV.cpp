@@ -1,17 +1,41 @@
 // WebDAV server using ESP8266 and SD card filesystem
 // Targeting Windows 7 Explorer WebDav
 
-#include <ESP8266WiFi.h>
 #include <SPI.h>
 #include <SdFat.h>
-#include <Hash.h>
 #include <time.h>
 #include "ESPWebDAV.h"
 
+#if defined(ESP32)
+	#include <mbedtls/sha1.h>
+
+	// hex digest like sha1() of the ESP8266 core's Hash library, for the ETag
+	static String sha1(const String& text)	{
+		uint8_t hash[20];
+		char hex[41];
+		mbedtls_sha1((const unsigned char *) text.c_str(), text.length(), hash);
+		for(int i = 0; i < 20; i++)
+			sprintf(hex + 2 * i, "%02x", hash[i]);
+		return String(hex);
+	}
+#else
+	#include <Hash.h>
+#endif
+
 // define cal constants
 const char *months[]  = {"Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
 const char *wdays[]  = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
 
+// upload cut short, what arrived is kept so the client can resume with a
+// Content-Range PUT from the size in Upload-Offset
+static const char timedOutMessage[] = "Timed out waiting for data";
+// data does not match the digest the client sent
+static const char mismatchMessage[] = "Digest mismatch";
+// the other master kept the card, the transfer stopped where it was
+static const char busLostMessage[] = "SD card in use by the other bus master";
+// not mounted yet or still counting free space
+static const char startingMessage[] = "SD card starting";
+
 
 // ------------------------
 bool ESPWebDAV::init(int chipSelectPin, SPISettings spiSettings, int serverPort) {
@@ -20,8 +44,21 @@ bool ESPWebDAV::init(int chipSelectPin, SPISettings spiSettings, int serverPort)
 	server = new WiFiServer(serverPort);
 	server->begin();
 	
-	// initialize the SD card
-	return sd.begin(chipSelectPin, spiSettings);
+	// free space unknown until the card is up
+	_freeClusters = -1;
+#if DAV_ENABLE_SEARCH
+	_indexClusters = -1;
+#endif
+	_clusterBytes = 512;
+
+	// the card is mounted and read in slices between requests, see warmUp
+	_chipSelectPin = chipSelectPin;
+	_spiSettings = spiSettings;
+	_warmState = WARM_MOUNT;
+	_bootStart = millis();
+	_mountTried = 0;
+	memset(&_bootStats, 0, sizeof(_bootStats));
+	return true;
 }
 
 
@@ -36,7 +73,7 @@ void ESPWebDAV::handleNotFound() {
 	message += method;
 	message += "\n";
 
-	sendHeader("Allow", "OPTIONS,MKCOL,POST,PUT");
+	sendHeader("Allow", allowHeader());
 	send("404 Not Found", "text/plain", message);
 	DBG_PRINTLN("404 Not Found");
 }
@@ -54,7 +91,7 @@ void ESPWebDAV::handleReject(String rejectMessage)	{
 	
 	// handle properties
 	if(method.equals("PROPFIND"))	{
-		sendHeader("Allow", "PROPFIND,OPTIONS,DELETE,COPY,MOVE");
+		sendHeader("Allow", allowHeader());
 		setContentLength(CONTENT_LENGTH_UNKNOWN);
 		send("207 Multi-Status", "application/xml;charset=utf-8", "");
 		sendContent(F("<?xml version=\"1.0\" encoding=\"utf-8\"?><D:multistatus xmlns:D=\"DAV:\"><D:response><D:href>/</D:href><D:propstat><D:status>HTTP/1.1 200 OK</D:status><D:prop><D:getlastmodified>Fri, 30 Nov 1979 00:00:00 GMT</D:getlastmodified><D:getetag>\"3333333333333333333333333333333333333333\"</D:getetag><D:resourcetype><D:collection/></D:resourcetype></D:prop></D:propstat></D:response>"));
@@ -83,6 +120,34 @@ void ESPWebDAV::handleReject(String rejectMessage)	{
 // ------------------------
 void ESPWebDAV::handleRequest(String blank)	{
 // ------------------------
+	// add header that gets sent everytime, class 2 needs LOCK
+	sendHeader("DAV", DAVConfig::lock ? "2" : "1");
+
+	// handle options, needs no card so it is answered during a blockout too
+	if(method.equals("OPTIONS"))
+		return handleOptions(RESOURCE_NONE);
+
+	// answered at once while the card starts, the client comes back later
+	if(!isCardReady())	{
+		_bootStats.busyReplies++;
+		return sendBusy(startingMessage);
+	}
+
+	// the other master has been using the card
+	if(!acquireBus())
+		return sendBusy(busLostMessage);
+
+	// clusters an upload took before the bus was lost last time
+	if(_lostCluster)	{
+		indexChain(_lostCluster, _lostSkip, false);
+		_lostCluster = 0;
+	}
+	// its temporary file may be longer than what arrived, not resumable
+	if(_lostUpload.length())	{
+		removeTracked(_lostUpload.c_str());
+		_lostUpload = String();
+	}
+
 	ResourceType resource = RESOURCE_NONE;
 
 	// does uri refer to a file or directory or a null?
@@ -96,9 +161,6 @@ void ESPWebDAV::handleRequest(String blank)	{
 	DBG_PRINT(" r: "); DBG_PRINT(resource);
 	DBG_PRINT(" u: "); DBG_PRINTLN(uri);
 
-	// add header that gets sent everytime
-	sendHeader("DAV", "2");
-
 	// handle properties
 	if(method.equals("PROPFIND"))
 		return handleProp(resource);
@@ -109,36 +171,44 @@ void ESPWebDAV::handleRequest(String blank)	{
 	if(method.equals("HEAD"))
 		return handleGet(resource, false);
 
-	// handle options
-	if(method.equals("OPTIONS"))
-		return handleOptions(resource);
-
 	// handle file create/uploads
 	if(method.equals("PUT"))
 		return handlePut(resource);
+
+	// update part of a file
+	if(DAVConfig::rangeWrite && method.equals("PATCH"))
+		return handleRangeWrite(resource);
+
+	// unpack an archive into a collection
+	if(DAVConfig::tar && method.equals("POST") && contentTypeHeader.startsWith("application/x-tar"))
+		return handleExtract(resource);
 	
 	// handle file locks
-	if(method.equals("LOCK"))
+	if(DAVConfig::lock && method.equals("LOCK"))
 		return handleLock(resource);
 	
-	if(method.equals("UNLOCK"))
+	if(DAVConfig::lock && method.equals("UNLOCK"))
 		return handleUnlock(resource);
 	
-	if(method.equals("PROPPATCH"))
+	if(DAVConfig::propPatch && method.equals("PROPPATCH"))
 		return handlePropPatch(resource);
 	
 	// directory creation
-	if(method.equals("MKCOL"))
+	if(DAVConfig::mkcol && method.equals("MKCOL"))
 		return handleDirectoryCreate(resource);
 
 	// move a file or directory
-	if(method.equals("MOVE"))
+	if(DAVConfig::move && method.equals("MOVE"))
 		return handleMove(resource);
 	
 	// delete a file or directory
-	if(method.equals("DELETE"))
+	if(DAVConfig::remove && method.equals("DELETE"))
 		return handleDelete(resource);
 
+	// query the filename index
+	if(DAVConfig::search && method.equals("SEARCH"))
+		return handleSearch(resource);
+
 	// if reached here, means its a 404
 	handleNotFound();
 }
@@ -149,12 +219,43 @@ void ESPWebDAV::handleRequest(String blank)	{
 void ESPWebDAV::handleOptions(ResourceType resource)	{
 // ------------------------
 	DBG_PRINTLN("Processing OPTION");
-	sendHeader("Allow", "PROPFIND,GET,DELETE,PUT,COPY,MOVE");
+	sendHeader("Allow", allowHeader());
+
+	if(DAVConfig::rangeWrite)
+		sendHeader("Accept-Patch", "application/x-sabredav-partialupdate");
+	if(DAVConfig::search)
+		sendHeader("DASL", "<DAV:basicsearch>");
 	send("200 OK", NULL, "");
 }
 
 
 
+// ------------------------
+String ESPWebDAV::allowHeader()	{
+// ------------------------
+	// the methods this build has compiled in, the same for every reply
+	String allow = F("OPTIONS,PROPFIND,GET,HEAD,PUT");
+	if(DAVConfig::rangeWrite)
+		allow += F(",PATCH");
+	if(DAVConfig::tar)
+		allow += F(",POST");
+	if(DAVConfig::lock)
+		allow += F(",LOCK,UNLOCK");
+	if(DAVConfig::propPatch)
+		allow += F(",PROPPATCH");
+	if(DAVConfig::mkcol)
+		allow += F(",MKCOL");
+	if(DAVConfig::move)
+		allow += F(",MOVE");
+	if(DAVConfig::remove)
+		allow += F(",DELETE");
+	if(DAVConfig::search)
+		allow += F(",SEARCH");
+	return allow;
+}
+
+
+
 // ------------------------
 void ESPWebDAV::handleLock(ResourceType resource)	{
 // ------------------------
@@ -164,17 +265,19 @@ void ESPWebDAV::handleLock(ResourceType resource)	{
 	if(resource == RESOURCE_NONE)
 		return handleNotFound();
 	
-	sendHeader("Allow", "PROPPATCH,PROPFIND,OPTIONS,DELETE,UNLOCK,COPY,LOCK,MOVE,HEAD,POST,PUT,GET");
+	sendHeader("Allow", allowHeader());
 	sendHeader("Lock-Token", "urn:uuid:26e57cb3-834d-191a-00de-000042bdecf9");
 
+	// a longer body is cut, the owner href comes early in it
 	size_t contentLen = contentLengthHeader.toInt();
-	uint8_t buf[1024];
-	size_t numRead = readBytesWithTimeout(buf, sizeof(buf), contentLen);
+	uint8_t buf[DAVConfig::lockBuffer];
+	size_t numToRead = (contentLen < sizeof(buf) - 1) ? contentLen : sizeof(buf) - 1;
+	size_t numRead = readBytesWithTimeout(buf, numToRead, numToRead);
 	
 	if(numRead == 0)
 		return handleNotFound();
 
-	buf[contentLen] = 0;
+	buf[numRead] = 0;
 	String inXML = String((char*) buf);
 	int startIdx = inXML.indexOf("<D:href>");
 	int endIdx = inXML.indexOf("</D:href>");
@@ -195,7 +298,7 @@ void ESPWebDAV::handleLock(ResourceType resource)	{
 void ESPWebDAV::handleUnlock(ResourceType resource)	{
 // ------------------------
 	DBG_PRINTLN("Processing UNLOCK");
-	sendHeader("Allow", "PROPPATCH,PROPFIND,OPTIONS,DELETE,UNLOCK,COPY,LOCK,MOVE,HEAD,POST,PUT,GET");
+	sendHeader("Allow", allowHeader());
 	sendHeader("Lock-Token", "urn:uuid:26e57cb3-834d-191a-00de-000042bdecf9");
 	send("204 No Content", NULL, "");
 }
@@ -228,16 +331,20 @@ void ESPWebDAV::handleProp(ResourceType resource)	{
 	if(resource == RESOURCE_NONE)
 		return handleNotFound();
 
-	if(resource == RESOURCE_FILE)
-		sendHeader("Allow", "PROPFIND,OPTIONS,DELETE,COPY,MOVE,HEAD,POST,PUT,GET");
-	else
-		sendHeader("Allow", "PROPFIND,OPTIONS,DELETE,COPY,MOVE");
+	sendHeader("Allow", allowHeader());
 
+	compressResponse();
 	setContentLength(CONTENT_LENGTH_UNKNOWN);
 	send("207 Multi-Status", "application/xml;charset=utf-8", "");
 	sendContent(F("<?xml version=\"1.0\" encoding=\"utf-8\"?>"));
 	sendContent(F("<D:multistatus xmlns:D=\"DAV:\">"));
 
+	// how long after boot a client first saw the share
+	if(!_bootStats.firstPropfindMs)	{
+		_bootStats.firstPropfindMs = millis() - _bootStart;
+		DBG_PRINT("First PROPFIND after: "); DBG_PRINTLN(_bootStats.firstPropfindMs);
+	}
+
 	// open this resource
 	SdFile baseFile;
 	baseFile.open(uri.c_str(), O_READ);
@@ -268,30 +375,51 @@ void ESPWebDAV::sendPropResponse(boolean recursing, FatFile *curFile)	{
 // String fullResPath = "http://" + hostHeader + uri;
 	String fullResPath = uri;
 
-	if(recursing)
+	if(recursing)	{
+		// keep the index files out of listings
+		if(SearchIndex::isHiddenFile(buf))
+			return;
+
 		if(fullResPath.endsWith("/"))
 			fullResPath += String(buf);
 		else
 			fullResPath += "/" + String(buf);
+	}
+
+	sendPropResponse(curFile, fullResPath);
+}
 
-	// get file modified time
-	dir_t dir;
-	curFile->dirEntry(&dir);
 
-	// convert to required format
+
+// ------------------------
+String ESPWebDAV::httpDate(uint16_t date, uint16_t time)	{
+// ------------------------
+	// FAT timestamp in the format of getlastmodified
+	char buf[40];
 	tm tmStr;
-	tmStr.tm_hour = FAT_HOUR(dir.lastWriteTime);
-	tmStr.tm_min = FAT_MINUTE(dir.lastWriteTime);
-	tmStr.tm_sec = FAT_SECOND(dir.lastWriteTime);
-	tmStr.tm_year = FAT_YEAR(dir.lastWriteDate) - 1900;
-	tmStr.tm_mon = FAT_MONTH(dir.lastWriteDate) - 1;
-	tmStr.tm_mday = FAT_DAY(dir.lastWriteDate);
+	tmStr.tm_hour = FAT_HOUR(time);
+	tmStr.tm_min = FAT_MINUTE(time);
+	tmStr.tm_sec = FAT_SECOND(time);
+	tmStr.tm_year = FAT_YEAR(date) - 1900;
+	tmStr.tm_mon = FAT_MONTH(date) - 1;
+	tmStr.tm_mday = FAT_DAY(date);
 	time_t t2t = mktime(&tmStr);
 	tm *gTm = gmtime(&t2t);
 
 	// Tue, 13 Oct 2015 17:07:35 GMT
 	sprintf(buf, "%s, %02d %s %04d %02d:%02d:%02d GMT", wdays[gTm->tm_wday], gTm->tm_mday, months[gTm->tm_mon], gTm->tm_year + 1900, gTm->tm_hour, gTm->tm_min, gTm->tm_sec);
-	String fileTimeStamp = String(buf);
+	return String(buf);
+}
+
+
+
+// ------------------------
+void ESPWebDAV::sendPropResponse(FatFile *curFile, const String& fullResPath)	{
+// ------------------------
+	// get file modified time
+	dir_t dir;
+	curFile->dirEntry(&dir);
+	String fileTimeStamp = httpDate(dir.lastWriteDate, dir.lastWriteTime);
 
 
 	// send the XML information about thyself to client
@@ -306,8 +434,10 @@ void ESPWebDAV::sendPropResponse(boolean recursing, FatFile *curFile)	{
 	sendContent("\"" + sha1(fullResPath + fileTimeStamp) + "\"");
 	sendContent(F("</D:getetag>"));
 
-	if(curFile->isDir())
+	if(curFile->isDir())	{
 		sendContent(F("<D:resourcetype><D:collection/></D:resourcetype>"));
+		sendQuotaProps();
+	}
 	else	{
 		sendContent(F("<D:resourcetype/><D:getcontentlength>"));
 		// append the file size
@@ -328,16 +458,31 @@ void ESPWebDAV::handleGet(ResourceType resource, bool isGet)	{
 // ------------------------
 	DBG_PRINTLN("Processing GET");
 
+	// filename query against the index
+	if(DAVConfig::search && queryArg("q").length())
+		return handleQuery(resource);
+
+	// whole collection as one archive
+	if(DAVConfig::tar && resource == RESOURCE_DIR && (queryArg("archive").equals("tar") || acceptHeader.indexOf("application/x-tar") >= 0))
+		return handleArchive(resource, isGet);
+
+	// a browser looking at a collection gets a listing
+	if(DAVConfig::htmlIndex && resource == RESOURCE_DIR)
+		return handleIndex(isGet);
+
+	// an upload cut short, where a Content-Range PUT continues it
+	if(DAVConfig::rangeWrite && !isGet)
+		sendUploadOffset();
+
 	// does URI refer to an existing file resource
 	if(resource != RESOURCE_FILE)
 		return handleNotFound();
 
 	SdFile rFile;
 	long tStart = millis();
-	uint8_t buf[1460];
 	rFile.open(uri.c_str(), O_READ);
 
-	sendHeader("Allow", "PROPFIND,OPTIONS,DELETE,COPY,MOVE,HEAD,POST,PUT,GET");
+	sendHeader("Allow", allowHeader());
 	size_t fileSize = rFile.fileSize();
 	setContentLength(fileSize);
 	String contentType = getMimeType(uri);
@@ -347,202 +492,1212 @@ void ESPWebDAV::handleGet(ResourceType resource, bool isGet)	{
 	send("200 OK", contentType.c_str(), "");
 
 	if(isGet)	{
-		// disable Nagle if buffer size > TCP MTU of 1460
-		// client.setNoDelay(1);
-
-		// send the file
-		while(rFile.available())	{
-			// SD read speed ~ 17sec for 4.5MB file
-			int numRead = rFile.read(buf, sizeof(buf));
-			client.write(buf, numRead);
+		// whole segments from here on, no need to hold them back for coalescing
+		setSendMode(SEND_BULK);
+
+		if(DAVConfig::pipeline && !_bus)	{
+			// card reads overlap socket writes
+			PipeTransfer xfer = { this, &rFile, fileSize, false };
+			if(!runPipeline(pipeFileRead, pipeClientWrite, &xfer))
+				DBG_PRINTLN("Pipelined send aborted");
+		}
+		else	{
+			// send the file
+			uint8_t buf[DAVConfig::sendBuffer];
+			while(rFile.available() && busYield(NULL))	{
+				// SD read speed ~ 17sec for 4.5MB file
+				int numRead = rFile.read(buf, sizeof(buf));
+				if(numRead <= 0)
+					break;
+				// a short send means the client is gone, the rest would be truncated anyway
+				if(sendBytes(buf, numRead) != (size_t) numRead)	{
+					DBG_PRINTLN("Send aborted");
+					break;
+				}
+			}
 		}
 	}
 
 	rFile.close();
 	DBG_PRINT("File "); DBG_PRINT(fileSize); DBG_PRINT(" bytes sent in: "); DBG_PRINT((millis() - tStart)/1000); DBG_PRINTLN(" sec");
+	DBG_PRINT("Send stalls: "); DBG_PRINT(_sendStats.stalls); DBG_PRINT(" retransmit waits: "); DBG_PRINT(_sendStats.retransmitWaits); DBG_PRINT(" wait ms: "); DBG_PRINTLN(_sendStats.waitMs);
+}
+
+
+
+
+// ------------------------
+void ESPWebDAV::handleArchive(ResourceType resource, bool isGet)	{
+// ------------------------
+	DBG_PRINTLN("Processing tar archive");
+	long tStart = millis();
+
+	String baseDir = uri;
+	if(baseDir.endsWith("/"))
+		baseDir.remove(baseDir.length() - 1);
+	if(baseDir.length() >= DAV_PATH_MAX)
+		return handleNotFound();
+
+	String fileName = baseDir.length() ? baseDir.substring(baseDir.lastIndexOf('/') + 1) : String("sdcard");
+	sendHeader("Content-Disposition", "attachment; filename=\"" + fileName + ".tar\"");
+	setContentLength(CONTENT_LENGTH_UNKNOWN);
+	send("200 OK", "application/x-tar", "");
+	// HEAD has no body, not even the last chunk
+	if(!isGet)	{
+		_chunked = false;
+		return;
+	}
+
+	// the size is unknown up front, blocks stream out as the tree is walked
+	// members are named relative to the collection
+	setSendMode(SEND_BULK);
+	ChunkBuffer cb;
+	cb.len = 0;
+	cb.ok = true;
+	TreeWalk *walk = new TreeWalk;
+	FatFile child;
+	walk->begin(&sd, baseDir.c_str());
+	while(cb.ok && walk->next(&child))	{
+		yield();
+		const char *name = walk->path() + baseDir.length() + 1;
+		if(!SearchIndex::isHiddenFile(strrchr(walk->path(), '/') + 1))	{
+			if(child.isDir())
+				tarEntry(&cb, &child, (String(name) + "/").c_str(), true);
+			else
+				tarEntry(&cb, &child, name, false);
+		}
+		child.close();
+	}
+	delete walk;
+
+	// two zero blocks end the archive
+	chunkPut(&cb, NULL, 2 * TAR_BLOCK);
+	if(!chunkFlush(&cb))	{
+		// no last chunk, the client can tell the archive is incomplete
+		DBG_PRINTLN("Archive send aborted");
+		_chunked = false;
+	}
+
+	DBG_PRINT("Archive "); DBG_PRINT(_sendStats.bytes); DBG_PRINT(" bytes sent in: "); DBG_PRINT((millis() - tStart)/1000); DBG_PRINTLN(" sec");
+}
+
+
+
+// ------------------------
+void ESPWebDAV::tarEntry(ChunkBuffer *cb, FatFile *file, const char *name, bool isDir)	{
+// ------------------------
+	dir_t dir;
+	uint32_t mtime = file->dirEntry(&dir) ? SearchIndex::fatToEpoch(dir.lastWriteDate, dir.lastWriteTime) : 0;
+	uint32_t size = isDir ? 0 : file->fileSize();
+	char type = isDir ? TAR_TYPE_DIR : TAR_TYPE_FILE;
+	size_t nameLen = strlen(name);
+
+	TarHeader header;
+	if(!TarFormat::makeHeader(&header, name, size, mtime, type))	{
+		// too long for ustar, a long name member carries it
+		TarFormat::makeLongName(&header, nameLen);
+		chunkPut(cb, (const uint8_t *) &header, TAR_BLOCK);
+		chunkPut(cb, (const uint8_t *) name, nameLen + 1);
+		chunkPut(cb, NULL, TarFormat::padding(nameLen + 1));
+		TarFormat::makeHeader(&header, name, size, mtime, type);
+	}
+	chunkPut(cb, (const uint8_t *) &header, TAR_BLOCK);
+	if(isDir)
+		return;
+
+	// file data is read straight into the chunk buffer
+	uint32_t numRemaining = size;
+	while(numRemaining && cb->ok && busYield(NULL))	{
+		size_t numToRead = DAVConfig::sendBuffer - cb->len;
+		if(numToRead > numRemaining)
+			numToRead = numRemaining;
+		int numRead = file->read(cb->buf + DAV_CHUNK_HEAD + cb->len, numToRead);
+		if(numRead <= 0)
+			break;
+
+		cb->len += numRead;
+		numRemaining -= numRead;
+		if(cb->len == DAVConfig::sendBuffer)
+			chunkFlush(cb);
+	}
+
+	// a short member would shift every header after it, end the archive here
+	if(numRemaining)	{
+		DBG_PRINTLN("Archive read failed");
+		cb->ok = false;
+		return;
+	}
+	chunkPut(cb, NULL, TarFormat::padding(size));
+}
+
+
+
+// ------------------------
+void ESPWebDAV::handleIndex(bool isGet)	{
+// ------------------------
+	DBG_PRINTLN("Processing HTML index");
+
+	// a page of the directory in its order on the card, sorted within the page
+	long offsetArg = queryArg("offset").toInt();
+	long limitArg = queryArg("limit").toInt();
+	uint32_t offset = (offsetArg > 0) ? offsetArg : 0;
+	uint32_t limit = (limitArg > 0 && (uint32_t) limitArg < DAVConfig::indexPage) ? limitArg : DAVConfig::indexPage;
+
+	String base = uri;
+	if(!base.endsWith("/"))
+		base += "/";
+
+	FatFile dir;
+	if(!dir.open(sd.vwd(), uri.c_str(), O_READ))
+		return handleNotFound();
+
+	// one page at a time, it lives on the heap as it does not fit the stack
+	IndexRow *rows = isGet ? new IndexRow[limit] : NULL;
+	if(isGet && !rows)	{
+		dir.close();
+		return send("500 Internal Server Error", "text/plain", "Out of memory");
+	}
+
+	sendHeader("Allow", allowHeader());
+	setContentLength(CONTENT_LENGTH_UNKNOWN);
+	send("200 OK", "text/html;charset=utf-8", "");
+	// HEAD has no body, not even the last chunk
+	if(!isGet)	{
+		_chunked = false;
+		dir.close();
+		return;
+	}
+
+	// the head goes out before the directory is read
+	setSendMode(SEND_BULK);
+	ChunkBuffer cb;
+	cb.len = 0;
+	cb.ok = true;
+	String html = F("<!DOCTYPE html><html><head><meta charset=\"utf-8\"><title>Index of ");
+	html += htmlEscape(base);
+	html += F("</title></head><body><h1>Index of ");
+	html += htmlEscape(base);
+	html += F("</h1><table><tr><th>Name</th><th>Size</th><th>Modified</th></tr>");
+	if(base.length() > 1)
+		html += F("<tr><td><a href=\"../\">../</a></td><td></td><td></td></tr>");
+	chunkPut(&cb, (const uint8_t *) html.c_str(), html.length());
+	chunkFlush(&cb);
+
+	bool hasMore = false;
+	uint32_t numRows = readIndexPage(&dir, rows, offset, limit, &hasMore);
+	sortIndexPage(&dir, rows, numRows);
+	for(uint32_t i = 0; i < numRows && cb.ok; i++)
+		sendIndexRow(&cb, &dir, &rows[i], base);
+	delete[] rows;
+	dir.close();
+
+	// links to the neighbouring pages
+	html = F("</table><p>");
+	if(numRows)
+		html += String(offset + 1) + "-" + String(offset + numRows);
+	if(offset)
+		html += " <a href=\"?offset=" + String((offset > limit) ? offset - limit : 0) + "&amp;limit=" + String(limit) + "\">previous</a>";
+	if(hasMore)
+		html += " <a href=\"?offset=" + String(offset + limit) + "&amp;limit=" + String(limit) + "\">next</a>";
+	html += F("</p></body></html>");
+	chunkPut(&cb, (const uint8_t *) html.c_str(), html.length());
+	if(!chunkFlush(&cb))	{
+		// no last chunk, the client can tell the page is incomplete
+		DBG_PRINTLN("Index send aborted");
+		_chunked = false;
+	}
+}
+
+
+
+// ------------------------
+uint32_t ESPWebDAV::readIndexPage(FatFile *dir, IndexRow *rows, uint32_t offset, uint32_t limit, bool *hasMore)	{
+// ------------------------
+	// skips offset entries, then keeps what is needed to sort and send the next limit
+	char name[DAV_PATH_MAX];
+	FatFile child;
+	uint32_t numSeen = 0;
+	uint32_t numRows = 0;
+
+	while(child.openNext(dir, O_READ))	{
+		yield();
+		if(child.getName(name, sizeof(name)) && !SearchIndex::isHiddenFile(name) && numSeen++ >= offset)	{
+			if(numRows == limit)	{
+				*hasMore = true;
+				child.close();
+				break;
+			}
+
+			IndexRow *row = &rows[numRows++];
+			dir_t entry;
+			child.dirEntry(&entry);
+			SearchIndex::makeKey(name, row->key);
+			row->isDir = child.isDir();
+			row->size = row->isDir ? 0 : child.fileSize();
+			row->date = entry.lastWriteDate;
+			row->time = entry.lastWriteTime;
+			row->dirIndex = child.dirIndex();
+		}
+		child.close();
+	}
+	return numRows;
+}
+
+
+
+// ------------------------
+void ESPWebDAV::sortIndexPage(FatFile *dir, IndexRow *rows, uint32_t numRows)	{
+// ------------------------
+	// insertion sort, folders first then by name ignoring case
+	for(uint32_t i = 1; i < numRows; i++)	{
+		IndexRow row = rows[i];
+		uint32_t j = i;
+		while(j > 0)	{
+			const IndexRow *prev = &rows[j - 1];
+			int cmp = (row.isDir != prev->isDir) ? (row.isDir ? -1 : 1) : strncmp(row.key, prev->key, DAV_INDEX_KEY);
+
+			// keys that are full may hide a difference further on
+			if(cmp == 0 && row.key[DAV_INDEX_KEY - 2])	{
+				char name[DAV_PATH_MAX];
+				char prevName[DAV_PATH_MAX];
+				if(indexRowName(dir, &row, name, sizeof(name)) && indexRowName(dir, prev, prevName, sizeof(prevName)))
+					cmp = strcasecmp(name, prevName);
+			}
+			if(cmp >= 0)
+				break;
+
+			rows[j] = rows[j - 1];
+			j--;
+		}
+		rows[j] = row;
+	}
+}
+
+
+
+// ------------------------
+bool ESPWebDAV::indexRowName(FatFile *dir, const IndexRow *row, char *buf, size_t bufSize)	{
+// ------------------------
+	FatFile file;
+	bool nameOk = file.open(dir, row->dirIndex, O_READ) && file.getName(buf, bufSize);
+	file.close();
+	return nameOk;
 }
 
 
 
+// ------------------------
+void ESPWebDAV::sendIndexRow(ChunkBuffer *cb, FatFile *dir, const IndexRow *row, const String& base)	{
+// ------------------------
+	char name[DAV_PATH_MAX];
+	if(!indexRowName(dir, row, name, sizeof(name)))
+		return;
+
+	String fileName = name;
+	if(row->isDir)
+		fileName += "/";
+
+	// size and date as PROPFIND reports them
+	String html = F("<tr><td><a href=\"");
+	html += urlEncode(base + fileName);
+	html += F("\">");
+	html += htmlEscape(fileName);
+	html += F("</a></td><td>");
+	html += row->isDir ? String("-") : String(row->size);
+	html += F("</td><td>");
+	html += httpDate(row->date, row->time);
+	html += F("</td></tr>");
+	chunkPut(cb, (const uint8_t *) html.c_str(), html.length());
+}
+
+
 
 // ------------------------
 void ESPWebDAV::handlePut(ResourceType resource)	{
 // ------------------------
 	DBG_PRINTLN("Processing Put");
 
+	// archive to unpack into a collection
+	if(DAVConfig::tar && queryArg("extract").equals("tar"))
+		return handleExtract(resource);
+
 	// does URI refer to a directory
 	if(resource == RESOURCE_DIR)
 		return handleNotFound();
 
-	SdFile nFile;
-	sendHeader("Allow", "PROPFIND,OPTIONS,DELETE,COPY,MOVE,HEAD,POST,PUT,GET");
-
-	// if file does not exist, create it
-	if(resource == RESOURCE_NONE)	{
-		if(!nFile.open(uri.c_str(), O_CREAT | O_WRITE))
-			return handleWriteError("Unable to create a new file", &nFile);
+	// part of a file, the rest of it stays
+	if(contentRangeHeader.length())	{
+		if(DAVConfig::rangeWrite)
+			return handleRangeWrite(resource);
+		// must not be taken for the whole file (RFC 7231 4.3.4)
+		return send("400 Bad Request", "text/plain", "Content-Range not supported");
 	}
 
-	// file is created/open for writing at this point
+	sendHeader("Allow", allowHeader());
 	DBG_PRINT(uri); DBG_PRINTLN(" - ready for data");
-	// did server send any data in put
 	size_t contentLen = contentLengthHeader.toInt();
 
-	if(contentLen != 0)	{
-		// buffer size is critical *don't change*
-		const size_t WRITE_BLOCK_CONST = 512;
-		uint8_t buf[WRITE_BLOCK_CONST];
-		long tStart = millis();
-		size_t numRemaining = contentLen;
+	// the body goes to a temporary name and replaces the file once complete,
+	// a timeout or a digest mismatch leaves the old file as it was
+	String target = uri + DAV_UPLOAD_SUFFIX;
+	// what is left of an earlier upload
+	removeTracked(target.c_str());
+
+	// after a timeout what arrived stays, a Content-Range PUT sends the rest
+	beginDigest();
+	const char *errMessage = receiveFile(target.c_str(), contentLen, DAVConfig::rangeWrite);
+	// nothing can be cleaned up without the card, it goes once the bus is back
+	if(errMessage == busLostMessage)	{
+		_lostUpload = target;
+		return sendBusy(errMessage);
+	}
+	if(!errMessage && !checkDigest())	{
+		removeTracked(target.c_str());
+		errMessage = mismatchMessage;
+	}
+	if(errMessage == timedOutMessage)	{
+		sendUploadOffset();
+		return send("408 Request Timeout", "text/plain", errMessage);
+	}
+	if(errMessage == mismatchMessage)
+		return send("400 Bad Request", "text/plain", errMessage);
+	if(errMessage)	{
+		DBG_PRINTLN(errMessage);
+		return send("500 Internal Server Error", "text/plain", errMessage);
+	}
+
+	// complete, the upload replaces the old file
+	if((resource == RESOURCE_FILE && !removeTracked(uri.c_str())) || !sd.rename(target.c_str(), uri.c_str()))	{
+		removeTracked(target.c_str());
+		return send("500 Internal Server Error", "text/plain", "Unable to replace the file");
+	}
+	indexTouch(target.c_str());
+	indexTouch(uri.c_str());
+
+	if(resource == RESOURCE_NONE)
+		send("201 Created", NULL, "");
+	else
+		send("200 OK", NULL, "");
+}
+
+
+
+
+// ------------------------
+const char *ESPWebDAV::receiveFile(const char *path, size_t contentLen, bool keepPartial)	{
+// ------------------------
+	// receive contentLen bytes from the client into a new file
+	// returns NULL on success, else the error and the file is removed
+	// unless the bus was lost, or it timed out with keepPartial
+	SdFile nFile;
+	long tStart = millis();
+	const char *errMessage;
 
-		// high speed raw write implementation
-		// close any previous file
+	// high speed raw write when the card has a free run big enough
+	size_t contBlocks = (contentLen/DAV_BLOCK_SIZE + 1);
+	if(hasContiguousRun(clustersFor(contBlocks * DAV_BLOCK_SIZE)) &&
+			createContiguousTracked(&nFile, path, contBlocks * DAV_BLOCK_SIZE))
+		errMessage = receiveContiguous(&nFile, contentLen, contBlocks);
+	else	{
+		// fragmented card, the file system spreads the file over several runs
 		nFile.close();
-		// delete old file
-		sd.remove(uri.c_str());
-	
-		// create a contiguous file
-		size_t contBlocks = (contentLen/WRITE_BLOCK_CONST + 1);
-		uint32_t bgnBlock, endBlock;
+		removeTracked(path);
+		errMessage = receiveFragmented(&nFile, path, contentLen);
+	}
+
+	if(errMessage == busLostMessage)
+		return errMessage;
+	nFile.close();
+	if(errMessage == timedOutMessage && keepPartial)
+		return errMessage;
+	if(errMessage)	{
+		removeTracked(path);
+		return errMessage;
+	}
+
+	indexTouch(path);
+	DBG_PRINT("File "); DBG_PRINT(contentLen); DBG_PRINT(" bytes stored in: "); DBG_PRINT((millis() - tStart)/1000); DBG_PRINTLN(" sec");
+	return NULL;
+}
 
-		if (!nFile.createContiguous(sd.vwd(), uri.c_str(), contBlocks * WRITE_BLOCK_CONST))
-			return handleWriteError("File create contiguous sections failed", &nFile);
 
-		// get the location of the file's blocks
-		if (!nFile.contiguousRange(&bgnBlock, &endBlock))
-			return handleWriteError("Unable to get contiguous range", &nFile);
 
-		if (!sd.card()->writeStart(bgnBlock, contBlocks))
-			return handleWriteError("Unable to start writing contiguous range", &nFile);
+// ------------------------
+const char *ESPWebDAV::receiveContiguous(FatFile *nFile, size_t contentLen, size_t contBlocks)	{
+// ------------------------
+	size_t numRemaining = contentLen;
+	uint32_t bgnBlock, endBlock;
+
+	// get the location of the file's blocks
+	if (!nFile->contiguousRange(&bgnBlock, &endBlock))
+		return "Unable to get contiguous range";
+
+	if (!sd.card()->writeStart(bgnBlock, contBlocks))
+		return "Unable to start writing contiguous range";
+
+	if(DAVConfig::pipeline && !_bus)	{
+		// socket reads overlap card writes
+		PipeTransfer xfer = { this, nFile, numRemaining, false };
+		bool pipeOk = runPipeline(pipeClientRead, pipeCardWrite, &xfer);
+		numRemaining = xfer.remaining;
+		if(!pipeOk)
+			return "Write data failed";
+	}
+	else	{
+		// buffer size is critical *don't change*
+		uint8_t buf[DAV_BLOCK_SIZE];
+		size_t numBlocks = 0;
 
 		// read data from stream and write to the file
 		while(numRemaining > 0)	{
-			size_t numToRead = (numRemaining > WRITE_BLOCK_CONST) ? WRITE_BLOCK_CONST : numRemaining;
-			size_t numRead = readBytesWithTimeout(buf, sizeof(buf), numToRead);
+			// the card leaves multi-block mode while the other master has the bus
+			if(_bus && _bus->leaseExpired())	{
+				if(!sd.card()->writeStop())
+					return "Unable to stop writing contiguous range";
+				if(!busYield(NULL))
+					return busLostMessage;
+				if(!sd.card()->writeStart(bgnBlock + numBlocks, contBlocks - numBlocks))
+					return "Unable to start writing contiguous range";
+			}
+
+			// never read past this body, an archive member may be followed by more
+			size_t numToRead = (numRemaining > DAV_BLOCK_SIZE) ? DAV_BLOCK_SIZE : numRemaining;
+			size_t numRead = readFull(buf, numToRead);
 			if(numRead == 0)
 				break;
+			digestBlock(buf, numRead);
 
 			// store whole buffer into file regardless of numRead
 			if (!sd.card()->writeData(buf))
-				return handleWriteError("Write data failed", &nFile);
+				return "Write data failed";
+			numBlocks++;
 
 			// reduce the number outstanding
 			numRemaining -= numRead;
-		}
-
-		// stop writing operation
-		if (!sd.card()->writeStop())
-			return handleWriteError("Unable to stop writing contiguous range", &nFile);
 
-		// detect timeout condition
-		if(numRemaining)
-			return handleWriteError("Timed out waiting for data", &nFile);
+			// short only on timeout, more data would land after stale bytes
+			if(numRead < numToRead)
+				break;
+		}
+	}
 
-		// truncate the file to right length
-		if(!nFile.truncate(contentLen))
-			return handleWriteError("Unable to truncate the file", &nFile);
+	// stop writing operation
+	if (!sd.card()->writeStop())
+		return "Unable to stop writing contiguous range";
 
-		DBG_PRINT("File "); DBG_PRINT(contentLen - numRemaining); DBG_PRINT(" bytes stored in: "); DBG_PRINT((millis() - tStart)/1000); DBG_PRINTLN(" sec");
-	}
+	// truncate the file to the length received
+	if(!truncateTracked(nFile, contentLen - numRemaining))
+		return "Unable to truncate the file";
 
-	if(resource == RESOURCE_NONE)
-		send("201 Created", NULL, "");
-	else
-		send("200 OK", NULL, "");
+	// detect timeout condition
+	if(numRemaining)
+		return timedOutMessage;
 
-	nFile.close();
+	return NULL;
 }
 
 
 
-
 // ------------------------
-void ESPWebDAV::handleWriteError(String message, FatFile *wFile)	{
+const char *ESPWebDAV::receiveFragmented(FatFile *nFile, const char *path, size_t contentLen)	{
 // ------------------------
-	// close this file
-	wFile->close();
-	// delete the wrile being written
-	sd.remove(uri.c_str());
-	// send error
-	send("500 Internal Server Error", "text/plain", message);
-	DBG_PRINTLN(message);
+	// the file system picks the clusters as the file grows
+	size_t numRemaining = contentLen;
+	bool writeOk = true;
+
+	if(!nFile->open(sd.vwd(), path, O_CREAT | O_WRITE | O_TRUNC))
+		return "Unable to create a new file";
+
+	writeOk = receiveToFile(nFile, &numRemaining);
+
+	// account for whatever got allocated, the file may be removed below
+	// a lost bus synced the file before it was handed over
+	if(!_busLost)
+		writeOk = nFile->sync() && writeOk;
+	trackWrittenFile(nFile);
+	if(_busLost)
+		return busLostMessage;
+
+	if(!writeOk)
+		return "Write data failed";
+
+	if(numRemaining)
+		return timedOutMessage;
+
+	return NULL;
 }
 
 
+
 // ------------------------
-void ESPWebDAV::handleDirectoryCreate(ResourceType resource)	{
+bool ESPWebDAV::receiveToFile(FatFile *nFile, size_t *numRemaining)	{
 // ------------------------
-	DBG_PRINTLN("Processing MKCOL");
-	
-	// does URI refer to anything
-	if(resource != RESOURCE_NONE)
-		return handleNotFound();
-	
-	// create directory
-	if (!sd.mkdir(uri.c_str(), true)) {
-		// send error
-		send("500 Internal Server Error", "text/plain", "Unable to create directory");
-		DBG_PRINTLN("Unable to create directory");
-		return;
+	// client data written at the current position of nFile
+	// false on a write error, numRemaining is left over on timeout
+	if(DAVConfig::pipeline && !_bus)	{
+		PipeTransfer xfer = { this, nFile, *numRemaining, false };
+		bool writeOk = runPipeline(pipeClientRead, pipeFileWrite, &xfer);
+		*numRemaining = xfer.remaining;
+		return writeOk;
 	}
 
-	DBG_PRINT(uri);	DBG_PRINTLN(" directory created");
-	sendHeader("Allow", "OPTIONS,MKCOL,LOCK,POST,PUT");
-	send("201 Created", NULL, "");
+	uint8_t buf[DAV_BLOCK_SIZE];
+	while(*numRemaining > 0)	{
+		if(!busYield(nFile))
+			return false;
+		size_t numToRead = (*numRemaining > DAV_BLOCK_SIZE) ? DAV_BLOCK_SIZE : *numRemaining;
+		size_t numRead = readBytesWithTimeout(buf, numToRead, numToRead);
+		if(numRead == 0)
+			break;
+
+		digestBlock(buf, numRead);
+		if(nFile->write(buf, numRead) != (int) numRead)
+			return false;
+		*numRemaining -= numRead;
+	}
+	return true;
 }
 
 
 
 // ------------------------
-void ESPWebDAV::handleMove(ResourceType resource)	{
+void ESPWebDAV::handleRangeWrite(ResourceType resource)	{
 // ------------------------
-	DBG_PRINTLN("Processing MOVE");
-	
-	// does URI refer to anything
-	if(resource == RESOURCE_NONE)
-		return handleNotFound();
+	DBG_PRINTLN("Processing range write");
 
-	if(destinationHeader.length() == 0)
+	// PUT with Content-Range, or PATCH with X-Update-Range
+	if(resource == RESOURCE_DIR)
 		return handleNotFound();
-	
-	String dest = urlDecode(urlToUri(destinationHeader));
-		
-	DBG_PRINT("Move destination: "); DBG_PRINTLN(dest);
 
-	// move file or directory
-	if ( !sd.rename(uri.c_str(), dest.c_str())	) {
-		// send error
-		send("500 Internal Server Error", "text/plain", "Unable to move");
-		DBG_PRINTLN("Unable to move file/directory");
-		return;
+	// SabreDAV partial update, only of an existing file
+	if(method.equals("PATCH"))	{
+		if(!contentTypeHeader.startsWith("application/x-sabredav-partialupdate"))
+			return send("415 Unsupported Media Type", "text/plain", "Expected application/x-sabredav-partialupdate");
+		if(resource == RESOURCE_NONE)
+			return handleNotFound();
 	}
 
-	DBG_PRINTLN("Move successful");
-	sendHeader("Allow", "OPTIONS,MKCOL,LOCK,POST,PUT");
-	send("201 Created", NULL, "");
-}
+	sendHeader("Allow", allowHeader());
+	size_t contentLen = contentLengthHeader.toInt();
+
+	// a PUT cut short continues in its temporary file, which replaces the
+	// file once the complete length has arrived
+	String part = uri + DAV_UPLOAD_SUFFIX;
+	bool isResume = !method.equals("PATCH") && sd.exists(part.c_str());
+	const char *path = isResume ? part.c_str() : uri.c_str();
+
+	FatFile nFile;
+	uint32_t fileSize = 0;
+	if(isResume || resource == RESOURCE_FILE)	{
+		if(!nFile.open(sd.vwd(), path, O_RDWR))
+			return send("500 Internal Server Error", "text/plain", "Unable to open the file");
+		fileSize = nFile.fileSize();
+	}
+
+	uint32_t offset;
+	int32_t total = -1;
+	bool rangeOk = method.equals("PATCH") ?
+		parseUpdateRange(updateRangeHeader, fileSize, contentLen, &offset) :
+		parseContentRange(contentRangeHeader, contentLen, &offset, &total);
+	if(!rangeOk)	{
+		nFile.close();
+		return send("400 Bad Request", "text/plain", "Invalid range");
+	}
+
+	// no holes, a range starts at most at the current end
+	if(offset > fileSize)	{
+		nFile.close();
+		sendHeader("Content-Range", "bytes */" + String(fileSize));
+		return send("416 Range Not Satisfiable", "text/plain", "Range starts past the end of the file");
+	}
 
+	if(!nFile.isOpen() && !nFile.open(sd.vwd(), path, O_CREAT | O_RDWR))
+		return send("500 Internal Server Error", "text/plain", "Unable to create a new file");
+
+	long tStart = millis();
+	beginDigest();
+	const char *errMessage = receiveRange(&nFile, offset, contentLen);
+	if(errMessage == busLostMessage)
+		return sendBusy(errMessage);
+	// written in place, a bad range can only be sent again
+	if(!errMessage && !checkDigest())
+		errMessage = mismatchMessage;
+
+	// the complete length is known, anything past it is left over from before
+	if(!errMessage && total >= 0 && nFile.fileSize() > (uint32_t) total && !truncateTracked(&nFile, total))
+		errMessage = "Unable to truncate the file";
+	bool isComplete = !errMessage && total >= 0 && nFile.fileSize() == (uint32_t) total;
+
+	nFile.close();
+	DBG_PRINT("Range "); DBG_PRINT(offset); DBG_PRINT("+"); DBG_PRINT(contentLen); DBG_PRINT(" stored in: "); DBG_PRINT((millis() - tStart)/1000); DBG_PRINTLN(" sec");
+
+	// a resumed upload replaces the file once all of it is there
+	if(isResume && isComplete)	{
+		if((resource == RESOURCE_FILE && !removeTracked(uri.c_str())) || !sd.rename(part.c_str(), uri.c_str()))
+			errMessage = "Unable to replace the file";
+		indexTouch(part.c_str());
+		isResume = false;
+	}
+	if(!isResume)
+		indexTouch(uri.c_str());
+
+	// the file is kept either way, HEAD tells the client where to resume
+	if(isResume)
+		sendUploadOffset();
+	if(errMessage == timedOutMessage)
+		return send("408 Request Timeout", "text/plain", errMessage);
+	if(errMessage == mismatchMessage)
+		return send("400 Bad Request", "text/plain", errMessage);
+	if(errMessage)
+		return send("500 Internal Server Error", "text/plain", errMessage);
+
+	// a part is not a file yet
+	if(resource == RESOURCE_NONE && !isResume)
+		send("201 Created", NULL, "");
+	else
+		send("204 No Content", NULL, "");
+}
 
 
 
 // ------------------------
-void ESPWebDAV::handleDelete(ResourceType resource)	{
+void ESPWebDAV::sendUploadOffset()	{
 // ------------------------
-	DBG_PRINTLN("Processing DELETE");
-	
-	// does URI refer to anything
-	if(resource == RESOURCE_NONE)
-		return handleNotFound();
+	// bytes of an upload to uri that timed out, the next range starts there
+	FatFile part;
+	String path = uri + DAV_UPLOAD_SUFFIX;
+	if(!part.open(sd.vwd(), path.c_str(), O_READ))
+		return;
+	sendHeader("Upload-Offset", String(part.fileSize()));
+	part.close();
+}
 
-	bool retVal;
-	
+
+
+// ------------------------
+void ESPWebDAV::handleExtract(ResourceType resource)	{
+// ------------------------
+	DBG_PRINTLN("Processing tar extract");
+
+	// members are created below the collection in uri
 	if(resource == RESOURCE_FILE)
-		// delete a file
-		retVal = sd.remove(uri.c_str());
+		return send("409 Conflict", "text/plain", "Not a collection");
+
+	String baseDir = uri;
+	if(baseDir.endsWith("/"))
+		baseDir.remove(baseDir.length() - 1);
+	if(resource == RESOURCE_NONE && !mkdirTracked(baseDir.c_str()))
+		return send("500 Internal Server Error", "text/plain", "Unable to create directory");
+	// one index update for the whole tree, merged once the reply is out
+	indexTouchTree(baseDir.c_str());
+
+	long tStart = millis();
+	size_t numRemaining = contentLengthHeader.toInt();
+	TarHeader header;
+	char name[DAV_PATH_MAX];
+	bool haveLongName = false;
+	// names that do not fit are not cut short into another path
+	bool nameTooLong = false;
+	const char *errMessage = NULL;
+	uint32_t numFiles = 0, numDirs = 0, numSkipped = 0, numListed = 0;
+	// one line per member until the summary is full, counts at the end
+	String summary;
+
+	while(numRemaining >= TAR_BLOCK)	{
+		if(readFull((uint8_t *) &header, TAR_BLOCK) < TAR_BLOCK)	{
+			errMessage = timedOutMessage;
+			break;
+		}
+		numRemaining -= TAR_BLOCK;
+
+		if(TarFormat::isEnd(&header))
+			break;
+		if(!TarFormat::checksumOk(&header))	{
+			errMessage = "Bad tar header checksum";
+			break;
+		}
+
+		uint32_t size = TarFormat::size(&header);
+		if(size > numRemaining || size + TarFormat::padding(size) > numRemaining)	{
+			errMessage = "Archive is truncated";
+			break;
+		}
+		uint32_t padding = TarFormat::padding(size);
+
+		// GNU long name or pax path, either one names the next member
+		if(header.typeflag == TAR_TYPE_LONGNAME || header.typeflag == TAR_TYPE_PAX)	{
+			char data[TAR_BLOCK];
+			size_t numKept = (size < sizeof(data)) ? size : sizeof(data);
+			if(readFull((uint8_t *) data, numKept) < numKept || !skipBody(size - numKept + padding))	{
+				errMessage = timedOutMessage;
+				break;
+			}
+			numRemaining -= size + padding;
+
+			if(header.typeflag == TAR_TYPE_LONGNAME)	{
+				size_t nameLen = strnlen(data, numKept);
+				nameTooLong = (nameLen >= sizeof(name));
+				if(nameTooLong)
+					nameLen = sizeof(name) - 1;
+				memcpy(name, data, nameLen);
+				name[nameLen] = 0;
+				haveLongName = true;
+			}
+			else if(TarFormat::paxPath(data, numKept, name, sizeof(name), &nameTooLong))
+				haveLongName = true;
+			continue;
+		}
+
+		if(!haveLongName && !TarFormat::fullName(&header, name, sizeof(name)))
+			nameTooLong = true;
+		haveLongName = false;
+
+		String path;
+		const char *status;
+		bool isFile = TarFormat::isFile(&header);
+		bool isDir = (header.typeflag == TAR_TYPE_DIR);
+
+		if(nameTooLong)
+			status = "skipped, name too long";
+		else if((!isFile && !isDir) || !tarMemberPath(baseDir, name, &path))
+			status = "skipped";
+		else if(isDir)	{
+			FatFile tFile;
+			bool exists = tFile.open(sd.vwd(), path.c_str(), O_READ);
+			bool wasDir = exists && tFile.isDir();
+			tFile.close();
+			if(wasDir)
+				status = "exists";
+			else if(!exists && mkdirTracked(path.c_str()))	{
+				status = "created";
+				numDirs++;
+			}
+			else
+				status = "failed";
+		}
+		else	{
+			// parent directories may not have their own members
+			int slashIdx = path.lastIndexOf('/');
+			FatFile tFile;
+			bool isDirNow = tFile.open(sd.vwd(), path.c_str(), O_READ) && tFile.isDir();
+			tFile.close();
+
+			if(isDirNow || (slashIdx > 0 && !sd.exists(path.substring(0, slashIdx).c_str()) && !mkdirTracked(path.substring(0, slashIdx).c_str())))
+				status = "failed";
+			else	{
+				// same path as a PUT, the member data is read straight from the client
+				removeTracked(path.c_str());
+				if(size)
+					errMessage = receiveFile(path.c_str(), size);
+				else	{
+					SdFile nFile;
+					if(!nFile.open(path.c_str(), O_CREAT | O_WRITE | O_TRUNC))
+						errMessage = "Unable to create a new file";
+					nFile.close();
+					indexTouch(path.c_str());
+				}
+				// where the stream stands after a failed member is unknown
+				if(errMessage)
+					break;
+				size = 0;
+				status = "created";
+				numFiles++;
+			}
+		}
+
+		if(!skipBody(size + padding))	{
+			errMessage = timedOutMessage;
+			break;
+		}
+		numRemaining -= size + padding;
+		nameTooLong = false;
+
+		if(status[0] != 'c')
+			numSkipped++;
+		if(summary.length() < DAVConfig::extractSummary)	{
+			summary += String(status) + " " + (path.length() ? path : String(name)) + "\n";
+			numListed++;
+		}
+	}
+
+	uint32_t numEntries = numFiles + numDirs + numSkipped;
+	if(numListed < numEntries)
+		summary += "... " + String(numEntries - numListed) + " more\n";
+	summary += String(numFiles) + " files, " + String(numDirs) + " directories, " + String(numSkipped) + " skipped\n";
+	DBG_PRINT("Extracted "); DBG_PRINT(numFiles); DBG_PRINT(" files in: "); DBG_PRINT((millis() - tStart)/1000); DBG_PRINTLN(" sec");
+
+	if(errMessage)	{
+		summary += String(errMessage) + "\n";
+		if(errMessage == busLostMessage)
+			return sendBusy(summary);
+		return send((errMessage == timedOutMessage) ? "408 Request Timeout" : "500 Internal Server Error", "text/plain", summary);
+	}
+
+	// trailing zero blocks and record padding
+	skipBody(numRemaining);
+	send("200 OK", "text/plain", summary);
+}
+
+
+
+// ------------------------
+bool ESPWebDAV::tarMemberPath(const String& baseDir, const char *name, String *path)	{
+// ------------------------
+	// archive name below baseDir, nothing may climb out of it
+	while(name[0] == '.' && name[1] == '/')
+		name += 2;
+	while(name[0] == '/')
+		name++;
+
+	String relPath = name;
+	while(relPath.endsWith("/"))
+		relPath.remove(relPath.length() - 1);
+	if(!relPath.length())
+		return false;
+
+	int idx = 0;
+	while(idx >= 0)	{
+		int end = relPath.indexOf('/', idx);
+		String part = relPath.substring(idx, (end < 0) ? relPath.length() : end);
+		if(!part.length() || part.equals(".") || part.equals("..") || SearchIndex::isHiddenFile(part.c_str()))
+			return false;
+		idx = (end < 0) ? -1 : end + 1;
+	}
+
+	*path = baseDir + "/" + relPath;
+	return path->length() < DAV_PATH_MAX;
+}
+
+
+
+// ------------------------
+bool ESPWebDAV::skipBody(size_t len)	{
+// ------------------------
+	uint8_t buf[128];
+	while(len > 0)	{
+		size_t numToRead = (len > sizeof(buf)) ? sizeof(buf) : len;
+		size_t numRead = readBytesWithTimeout(buf, numToRead, numToRead);
+		if(numRead == 0)
+			return false;
+		len -= numRead;
+	}
+	return true;
+}
+
+
+
+// ------------------------
+DigestType ESPWebDAV::pickDigest(const String& value, String *expected)	{
+// ------------------------
+	// strongest supported entry of "name=value, ..."
+	DigestType best = DIGEST_NONE;
+	int idx = 0;
+	while(idx < (int) value.length())	{
+		int end = value.indexOf(',', idx);
+		if(end < 0)
+			end = value.length();
+
+		String entry = value.substring(idx, end);
+		entry.trim();
+		// Want-Digest weights follow a ; or =
+		int nameEnd = 0;
+		while(nameEnd < (int) entry.length() && entry.charAt(nameEnd) != '=' && entry.charAt(nameEnd) != ';')
+			nameEnd++;
+
+		DigestType type = UploadDigest::parseName(entry.substring(0, nameEnd));
+		if(type > best)	{
+			best = type;
+			if(expected)
+				*expected = entry.substring(nameEnd + 1);
+		}
+		idx = end + 1;
+	}
+
+	if(expected)	{
+		// structured fields wrap the base64 in colons, padding is optional
+		expected->trim();
+		if(expected->startsWith(":"))
+			expected->remove(0, 1);
+		if(expected->endsWith(":"))
+			expected->remove(expected->length() - 1);
+		while(expected->endsWith("="))
+			expected->remove(expected->length() - 1);
+	}
+	return best;
+}
+
+
+
+// ------------------------
+bool ESPWebDAV::beginDigest()	{
+// ------------------------
+	// true when the client sent a digest to check, a wanted one is only computed
+#if DAV_ENABLE_DIGEST
+	_digestExpected = String();
+	DigestType type = pickDigest(digestHeader, digestWanted ? NULL : &_digestExpected);
+	_digest.begin(type);
+	return type != DIGEST_NONE && !digestWanted;
+#else
+	return false;
+#endif
+}
+
+
+
+// ------------------------
+bool ESPWebDAV::checkDigest()	{
+// ------------------------
+#if DAV_ENABLE_DIGEST
+	if(!_digest.isActive())
+		return true;
+
+	// the server's digest goes back in the form the client used
+	const char *digestName = UploadDigest::name(_digest.getType());
+	String value = _digest.finish();
+	if(digestField == FIELD_CONTENT_MD5)
+		sendHeader("Content-MD5", value);
+	else if(digestField == FIELD_DIGEST)
+		sendHeader("Digest", String(digestName) + "=" + value);
 	else
-		// delete a directory
-		retVal = sd.rmdir(uri.c_str());
+		sendHeader("Repr-Digest", String(digestName) + "=:" + value + ":");
+
+	if(!_digestExpected.length())
+		return true;
+
+	while(value.endsWith("="))
+		value.remove(value.length() - 1);
+	DBG_PRINT("Digest "); DBG_PRINT(digestName); DBG_PRINT(" got: "); DBG_PRINT(value); DBG_PRINT(" expected: "); DBG_PRINTLN(_digestExpected);
+	return value.equals(_digestExpected);
+#else
+	return true;
+#endif
+}
+
+
+
+// ------------------------
+bool ESPWebDAV::parseContentRange(const String& value, size_t contentLen, uint32_t *offset, int32_t *total)	{
+// ------------------------
+	// bytes first-last/total, total may be *
+	if(!value.startsWith("bytes "))
+		return false;
+
+	int dashIdx = value.indexOf('-');
+	int slashIdx = value.indexOf('/');
+	if(dashIdx < 0 || slashIdx < dashIdx)
+		return false;
+
+	uint32_t first = value.substring(6, dashIdx).toInt();
+	uint32_t last = value.substring(dashIdx + 1, slashIdx).toInt();
+	String totalText = value.substring(slashIdx + 1);
+	*total = totalText.equals("*") ? -1 : totalText.toInt();
+
+	if(last < first || (last - first + 1) != contentLen)
+		return false;
+	if(*total >= 0 && last >= (uint32_t) *total)
+		return false;
+
+	*offset = first;
+	return true;
+}
+
+
+
+// ------------------------
+bool ESPWebDAV::parseUpdateRange(const String& value, uint32_t fileSize, size_t contentLen, uint32_t *offset)	{
+// ------------------------
+	// SabreDAV partial update: append, bytes=first-last, bytes=first- or bytes=-fromEnd
+	if(value.equalsIgnoreCase("append"))	{
+		*offset = fileSize;
+		return true;
+	}
+
+	if(!value.startsWith("bytes="))
+		return false;
+
+	int dashIdx = value.indexOf('-', 6);
+	if(dashIdx < 0)
+		return false;
+
+	String firstText = value.substring(6, dashIdx);
+	String lastText = value.substring(dashIdx + 1);
+	if(!firstText.length())	{
+		uint32_t fromEnd = lastText.toInt();
+		if(!lastText.length() || fromEnd > fileSize)
+			return false;
+		*offset = fileSize - fromEnd;
+		return true;
+	}
+
+	*offset = firstText.toInt();
+	if(lastText.length())	{
+		uint32_t last = lastText.toInt();
+		if(last < *offset || (last - *offset + 1) != contentLen)
+			return false;
+	}
+	return true;
+}
+
+
+
+// ------------------------
+const char *ESPWebDAV::receiveRange(FatFile *nFile, uint32_t offset, size_t contentLen)	{
+// ------------------------
+	// write contentLen bytes from the client at offset, growing the file if needed
+	uint32_t oldSize = nFile->fileSize();
+	size_t numRemaining = contentLen;
+	bool writeOk = true;
+	bool timedOut = false;
+
+	// whole blocks over existing data of a contiguous file go straight to the card
+	uint32_t bgnBlock, endBlock;
+	size_t numBlocks = 0;
+	if((offset % DAV_BLOCK_SIZE) == 0 && offset < oldSize && nFile->contiguousRange(&bgnBlock, &endBlock))
+		numBlocks = ((contentLen < oldSize - offset) ? contentLen : oldSize - offset) / DAV_BLOCK_SIZE;
+
+	if(numBlocks)	{
+		// the volume cache may hold one of these blocks
+		if(!sd.vol()->cacheClear() || !sd.card()->writeStart(bgnBlock + offset / DAV_BLOCK_SIZE, numBlocks))
+			return "Unable to start writing contiguous range";
+
+		uint8_t buf[DAV_BLOCK_SIZE];
+		size_t numRead = 0;
+		while(numBlocks > 0)	{
+			if(_bus && _bus->leaseExpired())	{
+				if(!sd.card()->writeStop())
+					return "Unable to stop writing contiguous range";
+				if(!busYield(NULL))
+					return busLostMessage;
+				if(!sd.card()->writeStart(bgnBlock + offset / DAV_BLOCK_SIZE, numBlocks))
+					return "Unable to start writing contiguous range";
+			}
+
+			numRead = readFull(buf, DAV_BLOCK_SIZE);
+			if(numRead < DAV_BLOCK_SIZE)	{
+				timedOut = true;
+				break;
+			}
+
+			digestBlock(buf, DAV_BLOCK_SIZE);
+			if(!sd.card()->writeData(buf))	{
+				writeOk = false;
+				break;
+			}
+			offset += DAV_BLOCK_SIZE;
+			numRemaining -= DAV_BLOCK_SIZE;
+			numBlocks--;
+		}
+
+		if(!sd.card()->writeStop())
+			writeOk = false;
+
+		// a block cut short must not overwrite the rest of it
+		if(writeOk && timedOut && numRead)	{
+			digestBlock(buf, numRead);
+			writeOk = nFile->seekSet(offset) && nFile->write(buf, numRead) == (int) numRead;
+			offset += numRead;
+			numRemaining -= numRead;
+		}
+	}
+
+	// the rest goes through the file system, it allocates clusters as the file grows
+	if(writeOk && !timedOut && numRemaining)
+		writeOk = nFile->seekSet(offset) && receiveToFile(nFile, &numRemaining);
+
+	if(!_busLost)
+		writeOk = nFile->sync() && writeOk;
+	trackWrittenFile(nFile, oldSize);
+	if(_busLost)
+		return busLostMessage;
+
+	if(!writeOk)
+		return "Write data failed";
+
+	if(numRemaining)
+		return timedOutMessage;
+
+	return NULL;
+}
+
+
+// ------------------------
+void ESPWebDAV::handleDirectoryCreate(ResourceType resource)	{
+// ------------------------
+	DBG_PRINTLN("Processing MKCOL");
+	
+	// does URI refer to anything
+	if(resource != RESOURCE_NONE)
+		return handleNotFound();
+	
+	// create directory
+	if (!mkdirTracked(uri.c_str())) {
+		// send error
+		send("500 Internal Server Error", "text/plain", "Unable to create directory");
+		DBG_PRINTLN("Unable to create directory");
+		return;
+	}
+
+	DBG_PRINT(uri);	DBG_PRINTLN(" directory created");
+	sendHeader("Allow", allowHeader());
+	send("201 Created", NULL, "");
+}
+
+
+
+// ------------------------
+void ESPWebDAV::handleMove(ResourceType resource)	{
+// ------------------------
+	DBG_PRINTLN("Processing MOVE");
+	
+	// does URI refer to anything
+	if(resource == RESOURCE_NONE)
+		return handleNotFound();
+
+	if(destinationHeader.length() == 0)
+		return handleNotFound();
+	
+	String dest = urlDecode(urlToUri(destinationHeader));
 		
+	DBG_PRINT("Move destination: "); DBG_PRINTLN(dest);
+
+	// move file or directory
+	if ( !sd.rename(uri.c_str(), dest.c_str())	) {
+		// send error
+		send("500 Internal Server Error", "text/plain", "Unable to move");
+		DBG_PRINTLN("Unable to move file/directory");
+		return;
+	}
+
+	// a moved directory changes every path below it
+	if(resource == RESOURCE_DIR)	{
+		indexTouchTree(uri.c_str());
+		indexTouchTree(dest.c_str());
+	}
+	else	{
+		indexTouch(uri.c_str());
+		indexTouch(dest.c_str());
+	}
+
+	DBG_PRINTLN("Move successful");
+	sendHeader("Allow", allowHeader());
+	send("201 Created", NULL, "");
+}
+
+
+
+
+// ------------------------
+void ESPWebDAV::handleDelete(ResourceType resource)	{
+// ------------------------
+	DBG_PRINTLN("Processing DELETE");
+	
+	// does URI refer to anything
+	if(resource == RESOURCE_NONE)
+		return handleNotFound();
+
+	// delete a file or an empty directory
+	bool retVal = removeTracked(uri.c_str());
+
 	if(!retVal)	{
 		// send error
 		send("500 Internal Server Error", "text/plain", "Unable to delete");
@@ -551,7 +1706,945 @@ void ESPWebDAV::handleDelete(ResourceType resource)	{
 	}
 
 	DBG_PRINTLN("Delete successful");
-	sendHeader("Allow", "OPTIONS,MKCOL,LOCK,POST,PUT");
+	sendHeader("Allow", allowHeader());
 	send("200 OK", NULL, "");
 }
 
+
+
+
+// ------------------------
+void ESPWebDAV::handleSearch(ResourceType resource)	{
+// ------------------------
+	DBG_PRINTLN("Processing SEARCH");
+
+	// RFC 5323 basicsearch, all conditions must hold
+	String inXML = readBody(DAVConfig::maxBody);
+	if(findElement(inXML, "basicsearch", 0) < 0)	{
+		send("400 Bad Request", "text/plain", "Only DAV:basicsearch is supported");
+		DBG_PRINTLN("Unsupported search grammar");
+		return;
+	}
+
+	SearchQuery query;
+	query.scope = uri;
+	int idx = findElement(inXML, "scope", 0);
+	if(idx >= 0 && (idx = findElement(inXML, "href", idx)) >= 0)
+		query.scope = urlDecode(urlToUri(elementText(inXML, idx)));
+
+	const char *ops[] = { "eq", "like", "gt", "gte", "lt", "lte" };
+	for(size_t i = 0; i < sizeof(ops)/sizeof(ops[0]); i++)	{
+		for(idx = findElement(inXML, ops[i], 0); idx >= 0; idx = findElement(inXML, ops[i], idx + 1))	{
+			int litIdx = findElement(inXML, "literal", idx);
+			if(litIdx < 0)
+				continue;
+
+			// the property named between the operator and its literal
+			String prop = inXML.substring(idx, litIdx);
+			String literal = elementText(inXML, litIdx);
+			if(prop.indexOf("displayname") >= 0)	{
+				if(i == 0)
+					query.nameEq = literal;
+				else if(i == 1)
+					query.nameLike = literal;
+			}
+			else if(prop.indexOf("getcontentlength") >= 0)
+				applyRange(ops[i], literal.toInt(), &query.minSize, &query.maxSize);
+			else if(prop.indexOf("getlastmodified") >= 0)
+				applyRange(ops[i], parseHttpDate(literal), &query.minTime, &query.maxTime);
+		}
+	}
+
+	idx = findElement(inXML, "nresults", 0);
+	if(idx >= 0)
+		query.limit = elementText(inXML, idx).toInt();
+
+	if(searchUnavailable())
+		return;
+
+	compressResponse();
+	setContentLength(CONTENT_LENGTH_UNKNOWN);
+	send("207 Multi-Status", "application/xml;charset=utf-8", "");
+	sendContent(F("<?xml version=\"1.0\" encoding=\"utf-8\"?>"));
+	sendContent(F("<D:multistatus xmlns:D=\"DAV:\">"));
+#if DAV_ENABLE_SEARCH
+	_search.search(query, searchHitProp, this);
+#endif
+	sendContent(F("</D:multistatus>"));
+}
+
+
+
+// ------------------------
+void ESPWebDAV::handleQuery(ResourceType resource)	{
+// ------------------------
+	DBG_PRINTLN("Processing query");
+
+	// searches the directory in uri and below
+	if(resource != RESOURCE_DIR)
+		return handleNotFound();
+
+	// shell style wildcards, plain text has to match the whole name
+	SearchQuery query;
+	query.scope = uri;
+	String pattern = queryArg("q");
+	if(pattern.indexOf('*') >= 0 || pattern.indexOf('?') >= 0)	{
+		pattern.replace("*", "%");
+		pattern.replace("?", "_");
+		query.nameLike = pattern;
+	}
+	else
+		query.nameEq = pattern;
+
+	String arg = queryArg("minsize");
+	if(arg.length())
+		query.minSize = arg.toInt();
+	arg = queryArg("maxsize");
+	if(arg.length())
+		query.maxSize = arg.toInt();
+	arg = queryArg("limit");
+	if(arg.length())
+		query.limit = arg.toInt();
+
+	if(searchUnavailable())
+		return;
+
+	// one line per hit: path, size, seconds since 1970
+	setContentLength(CONTENT_LENGTH_UNKNOWN);
+	send("200 OK", "text/plain;charset=utf-8", "");
+#if DAV_ENABLE_SEARCH
+	_search.search(query, searchHitLine, this);
+#endif
+}
+
+
+
+// ------------------------
+bool ESPWebDAV::searchHitProp(void *ctx, const char *path, const IndexRecord *rec)	{
+// ------------------------
+	ESPWebDAV *dav = (ESPWebDAV *) ctx;
+	FatFile tFile;
+	if(tFile.open(dav->sd.vwd(), path, O_READ))	{
+		dav->sendPropResponse(&tFile, String(path));
+		tFile.close();
+	}
+	return dav->client.connected();
+}
+
+
+
+// ------------------------
+bool ESPWebDAV::searchHitLine(void *ctx, const char *path, const IndexRecord *rec)	{
+// ------------------------
+	ESPWebDAV *dav = (ESPWebDAV *) ctx;
+	String line = path;
+	if(rec->pathOffset & DAV_INDEX_DIR)
+		line += "/";
+	line += "\t" + String(rec->size) + "\t" + String(rec->mtime) + "\n";
+	dav->sendContent(line);
+	return dav->client.connected();
+}
+
+
+
+// ------------------------
+void ESPWebDAV::applyRange(const char *op, uint32_t value, uint32_t *minValue, uint32_t *maxValue)	{
+// ------------------------
+	if(strcmp(op, "eq") == 0)
+		*minValue = *maxValue = value;
+	else if(strcmp(op, "gt") == 0)
+		*minValue = value + 1;
+	else if(strcmp(op, "gte") == 0)
+		*minValue = value;
+	else if(strcmp(op, "lt") == 0)
+		*maxValue = value ? value - 1 : 0;
+	else if(strcmp(op, "lte") == 0)
+		*maxValue = value;
+}
+
+
+
+// ------------------------
+uint32_t ESPWebDAV::parseHttpDate(const String& date)	{
+// ------------------------
+	// Tue, 13 Oct 2015 17:07:35 GMT, or plain seconds since 1970
+	int day, year, hour, minute, second;
+	char mon[4];
+	const char *p = strchr(date.c_str(), ',');
+	if(!p || sscanf(p + 1, "%d %3s %d %d:%d:%d", &day, mon, &year, &hour, &minute, &second) != 6)
+		return date.toInt();
+
+	for(int m = 0; m < 12; m++)
+		if(strcmp(mon, months[m]) == 0)
+			return SearchIndex::civilToEpoch(year, m + 1, day, hour, minute, second);
+	return 0;
+}
+
+
+
+// ------------------------
+void ESPWebDAV::indexTouch(const char *path)	{
+// ------------------------
+#if DAV_ENABLE_SEARCH
+	// merge now if there is no room for another pending path, a merge is
+	// one step. with a rebuild pending or under way touch takes care of it
+	if(_search.isFull() && !_search.covers(path) && _search.isReady())
+		stepSearchIndex();
+	_search.touch(path);
+#endif
+}
+
+
+
+// ------------------------
+void ESPWebDAV::indexTouchTree(const char *path)	{
+// ------------------------
+#if DAV_ENABLE_SEARCH
+	if(_search.isFull() && _search.isReady())
+		stepSearchIndex();
+	_search.touchTree(path);
+#endif
+}
+
+
+
+// ------------------------
+void ESPWebDAV::syncSearchIndex()	{
+// ------------------------
+	// merge or rebuild the filename index in slices while nobody is waiting,
+	// the other master gets the bus back once the lease is up
+#if DAV_ENABLE_SEARCH
+	if(!isCardReady() || !_search.isPending() || isClientWaiting())
+		return;
+	if(_bus && !_bus->isHeld() && (_bus->isBlocked() || !_bus->acquire(false)))
+		return;
+
+	uint32_t tStart = millis();
+	while(millis() - tStart < DAVConfig::warmSlice && !isClientWaiting())	{
+		if(_bus && _bus->leaseExpired())
+			break;
+		if(!stepSearchIndex())
+			break;
+		yield();
+	}
+#endif
+}
+
+
+
+// ------------------------
+bool ESPWebDAV::searchUnavailable()	{
+// ------------------------
+	// changes not merged yet are merged between requests, the client asks
+	// again. true when the 503 was sent
+#if DAV_ENABLE_SEARCH
+	if(_search.isReady() && !_search.isPending())
+		return false;
+	sendHeader("Retry-After", _search.isReady() ? "1" : "10");
+	send("503 Service Unavailable", "text/plain", "Search index is not available");
+	return true;
+#else
+	return false;
+#endif
+}
+
+
+
+// ------------------------
+bool ESPWebDAV::stepSearchIndex()	{
+// ------------------------
+	// one step of a merge or rebuild, true while there is more to do
+#if DAV_ENABLE_SEARCH
+	if(!_search.isPending())
+		return false;
+
+	// the index files are rewritten, account for their clusters like any other file
+	// counted once before the first step and settled after the last
+	if(_indexClusters < 0)
+		_indexClusters = indexFileClusters(true);
+	if(_search.flushStep())
+		return true;
+	adjustFreeClusters(_indexClusters - indexFileClusters(false));
+	_indexClusters = -1;
+#endif
+	return false;
+}
+
+
+
+// ------------------------
+int32_t ESPWebDAV::indexFileClusters(bool isFree)	{
+// ------------------------
+	const char *names[] = { DAV_INDEX_FILE, DAV_PATHS_FILE };
+	int32_t numClusters = 0;
+
+	for(size_t i = 0; i < sizeof(names)/sizeof(names[0]); i++)	{
+		FatFile tFile;
+		if(!tFile.open(sd.vwd(), names[i], O_READ))
+			continue;
+		numClusters += fileClusters(&tFile);
+		uint32_t bgnCluster = firstCluster(&tFile);
+		tFile.close();
+		indexChain(bgnCluster, 0, isFree);
+	}
+	return numClusters;
+}
+
+
+
+
+// ------------------------
+void ESPWebDAV::warmUp()	{
+// ------------------------
+	// one slice of the card start, run while no client is waiting
+	// a blockout is waited out, warm-up is not counted as a request
+	// and the card is not touched unless the bus could be taken
+	if(_warmState == WARM_DONE || (_bus && _bus->isBlocked()))
+		return;
+	if(_bus && !_bus->acquire(false))
+		return;
+
+	uint32_t tStart = millis();
+	while(_warmState != WARM_DONE && millis() - tStart < DAVConfig::warmSlice)	{
+		if(!warmStep())
+			break;
+		yield();
+	}
+}
+
+
+
+// ------------------------
+bool ESPWebDAV::warmStep()	{
+// ------------------------
+	// false when there is nothing more to do in this slice
+	if(_warmState == WARM_MOUNT)	{
+		// no card or not answering yet, tried again a little later
+		if(_bootStats.mountTries && millis() - _mountTried < DAVConfig::mountRetry)
+			return false;
+		_mountTried = millis();
+		_bootStats.mountTries++;
+		if(!sd.begin(_chipSelectPin, _spiSettings))	{
+			DBG_PRINTLN("SD card not mounted");
+			return false;
+		}
+
+		_bootStats.mountMs = millis() - _bootStart;
+		DBG_PRINT("SD card mounted after: "); DBG_PRINTLN(_bootStats.mountMs);
+		_warmState = (DAVConfig::quota && !initFreeSpace()) ? WARM_FREE_SPACE : WARM_SEARCH;
+		return true;
+	}
+
+	if(_warmState == WARM_FREE_SPACE)	{
+		// one full FAT pass, kept up to date afterwards
+		if(!scanFreeSpace(DAVConfig::warmBlocks))
+			return true;
+		DBG_PRINT("Free clusters: "); DBG_PRINTLN(_freeClusters);
+#if DAV_ENABLE_QUOTA
+		DBG_PRINT("Free runs indexed: "); DBG_PRINT(_extents.count());
+		DBG_PRINT(" largest: "); DBG_PRINTLN(_extents.largest());
+#endif
+		_warmState = WARM_SEARCH;
+		return true;
+	}
+
+	if(_warmState == WARM_SEARCH)	{
+		// check the filename index
+#if DAV_ENABLE_SEARCH
+		_search.begin(&sd);
+		_indexClusters = -1;
+#endif
+		_warmState = WARM_INDEX;
+		return true;
+	}
+
+	if(_warmState == WARM_INDEX)	{
+		// a stale index is rebuilt a step at a time
+		if(stepSearchIndex())
+			return true;
+
+		_bootStats.readyMs = millis() - _bootStart;
+		DBG_PRINT("SD card ready after: "); DBG_PRINTLN(_bootStats.readyMs);
+		_warmState = WARM_STALE;
+		return true;
+	}
+
+	if(_warmState == WARM_STALE)	{
+		if(warmStale())
+			return true;
+		_warmState = WARM_ROOT;
+		_warmPos = 0;
+		return true;
+	}
+
+	if(_warmState == WARM_ROOT)	{
+		if(warmRoot())
+			return true;
+		_bootStats.warmMs = millis() - _bootStart;
+		DBG_PRINT("Root warmed after: "); DBG_PRINTLN(_bootStats.warmMs);
+		_warmState = WARM_DONE;
+	}
+	return false;
+}
+
+
+
+// ------------------------
+bool ESPWebDAV::warmStale()	{
+// ------------------------
+	// one entry of a walk over the card, uploads cut off by a reset are removed
+	// returns false once the whole card has been seen
+	if(!_warmWalk)	{
+		_warmWalk = new TreeWalk;
+		_warmWalk->begin(&sd, "");
+	}
+
+	FatFile child;
+	if(!_warmWalk->next(&child))	{
+		delete _warmWalk;
+		_warmWalk = NULL;
+		return false;
+	}
+
+	bool isStale = !child.isDir() && SearchIndex::isUploadFile(strrchr(_warmWalk->path(), '/') + 1);
+	child.close();
+	if(isStale)	{
+		DBG_PRINT("Removing stale upload: "); DBG_PRINTLN(_warmWalk->path());
+		removeTracked(_warmWalk->path());
+	}
+	return true;
+}
+
+
+
+// ------------------------
+bool ESPWebDAV::warmRoot()	{
+// ------------------------
+	// one root entry and its name read, as the first PROPFIND does
+	// returns false once the whole root directory has been seen
+	FatFile root;
+	if(!root.openRoot(sd.vol()) || !root.seekSet(_warmPos))
+		return false;
+
+	FatFile child;
+	char name[DAV_PATH_MAX];
+	bool entryOk = child.openNext(&root, O_READ);
+	_warmPos = root.curPosition();
+	root.close();
+	if(!entryOk)
+		return false;
+
+	child.getName(name, sizeof(name));
+	child.close();
+	return true;
+}
+
+
+
+// ------------------------
+bool ESPWebDAV::acquireBus()	{
+// ------------------------
+	// true right away without another master
+	return !_bus || _bus->acquire();
+}
+
+
+
+// ------------------------
+void ESPWebDAV::releaseBus()	{
+// ------------------------
+	if(!_bus || !_bus->isHeld())
+		return;
+
+	// cached blocks are stale once the other master had the card
+	sd.vol()->cacheClear();
+	_bus->release();
+}
+
+
+
+// ------------------------
+bool ESPWebDAV::busYield(FatFile *file)	{
+// ------------------------
+	// between bursts of a long transfer, the other master gets its turn once the lease is up
+	if(!_bus || !_bus->leaseExpired())
+		return true;
+
+	// leave the card consistent, the other master may read it meanwhile
+	if(file)
+		file->sync();
+	sd.vol()->cacheClear();
+	if(_bus->handOver())
+		return true;
+
+	// not given back in time, nothing may touch the card until the next request
+	DBG_PRINTLN("Bus not returned, transfer stopped");
+	_busLost = true;
+	return false;
+}
+
+
+
+// ------------------------
+void ESPWebDAV::sendBusy(const String& message)	{
+// ------------------------
+	sendHeader("Retry-After", String(_bus ? _bus->retryAfter() : 1));
+	send("503 Service Unavailable", "text/plain", message);
+}
+
+
+
+
+// ------------------------
+bool ESPWebDAV::runPipeline(DAVPipeline::Producer producer, DAVPipeline::Consumer consumer, PipeTransfer *xfer)	{
+// ------------------------
+	// ring lives on the heap, it does not fit the stack
+	DAVRing *ring = new DAVRing();
+	if(!ring)
+		return false;
+
+	DAVPipeline pipe(ring, producer, consumer, xfer);
+	bool retVal = pipe.run();
+
+	DBG_PRINT("Pipeline blocks: "); DBG_PRINT(ring->stats.blocks);
+	DBG_PRINT(" producer stalls: "); DBG_PRINT(ring->stats.producerStalls);
+	DBG_PRINT(" consumer stalls: "); DBG_PRINTLN(ring->stats.consumerStalls);
+#if DAV_USE_PIPELINE
+	_pipelineStats = ring->stats;
+#endif
+	delete ring;
+	return retVal;
+}
+
+
+
+// ------------------------
+size_t ESPWebDAV::pipeFileRead(void *ctx, uint8_t *data, size_t size)	{
+// ------------------------
+	PipeTransfer *xfer = (PipeTransfer *) ctx;
+	int numRead = xfer->file->read(data, size);
+	return (numRead > 0) ? numRead : 0;
+}
+
+
+
+// ------------------------
+bool ESPWebDAV::pipeClientWrite(void *ctx, const uint8_t *data, size_t length)	{
+// ------------------------
+	PipeTransfer *xfer = (PipeTransfer *) ctx;
+	return xfer->dav->sendBytes(data, length) == length;
+}
+
+
+
+// ------------------------
+size_t ESPWebDAV::pipeClientRead(void *ctx, uint8_t *data, size_t size)	{
+// ------------------------
+	PipeTransfer *xfer = (PipeTransfer *) ctx;
+	if(xfer->remaining == 0 || xfer->timedOut)
+		return 0;
+
+	// a short block ends the transfer, more data would land after stale bytes
+	size_t numToRead = (xfer->remaining > size) ? size : xfer->remaining;
+	size_t numRead = xfer->dav->readFull(data, numToRead);
+	xfer->dav->digestBlock(data, numRead);
+	xfer->remaining -= numRead;
+	xfer->timedOut = (numRead < numToRead);
+	return numRead;
+}
+
+
+
+// ------------------------
+bool ESPWebDAV::pipeCardWrite(void *ctx, const uint8_t *data, size_t length)	{
+// ------------------------
+	PipeTransfer *xfer = (PipeTransfer *) ctx;
+	// store whole block into file regardless of length
+	return xfer->dav->sd.card()->writeData(data);
+}
+
+
+
+
+// ------------------------
+bool ESPWebDAV::pipeFileWrite(void *ctx, const uint8_t *data, size_t length)	{
+// ------------------------
+	PipeTransfer *xfer = (PipeTransfer *) ctx;
+	return xfer->file->write(data, length) == (int) length;
+}
+
+
+
+
+// ------------------------
+bool ESPWebDAV::initFreeSpace()	{
+// ------------------------
+	// returns true when counted already, else scanFreeSpace walks the FAT
+	FatVolume *vol = sd.vol();
+	_clusterBytes = (uint32_t) vol->blocksPerCluster() * 512;
+#if DAV_ENABLE_QUOTA
+	_extents.clear();
+#endif
+	_scanBlock = 0;
+	_scanFree = 0;
+
+	// FAT12 entries straddle blocks, leave those to SdFat
+	if(vol->fatType() != 16 && vol->fatType() != 32)	{
+		_freeClusters = vol->freeClusterCount();
+		return true;
+	}
+	return false;
+}
+
+
+
+// ------------------------
+bool ESPWebDAV::scanFreeSpace(uint32_t maxBlocks)	{
+// ------------------------
+	// one pass over the FAT counts the free clusters and indexes the free runs
+	// returns true once the whole FAT has been seen
+	FatVolume *vol = sd.vol();
+	uint32_t entriesPerBlock = (vol->fatType() == 32) ? 128 : 256;
+	uint32_t lastCluster = vol->clusterCount() + 1;
+	uint8_t buf[512];
+
+	while(maxBlocks--)	{
+		uint32_t cluster = _scanBlock * entriesPerBlock;
+		if(cluster > lastCluster)	{
+#if DAV_ENABLE_QUOTA
+			_extents.endScan();
+#endif
+			_freeClusters = _scanFree;
+			return true;
+		}
+
+		if(!sd.card()->readBlock(vol->fatStartBlock() + _scanBlock, buf))	{
+			// no index, fall back to SdFat's own count
+#if DAV_ENABLE_QUOTA
+			_extents.clear();
+#endif
+			_freeClusters = vol->freeClusterCount();
+			return true;
+		}
+
+		for(uint32_t i = 0; i < entriesPerBlock && cluster <= lastCluster; i++, cluster++)	{
+			if(cluster < 2)
+				continue;
+			bool isFree = (fatEntry(buf, i) == 0);
+			if(isFree)
+				_scanFree++;
+#if DAV_ENABLE_QUOTA
+			_extents.scanCluster(cluster, isFree);
+#endif
+		}
+		_scanBlock++;
+	}
+	return false;
+}
+
+
+
+// ------------------------
+uint32_t ESPWebDAV::fatEntry(const uint8_t *block, uint32_t idx)	{
+// ------------------------
+	// little endian, block buffer need not be aligned
+	if(sd.vol()->fatType() == 32)	{
+		const uint8_t *p = block + idx * 4;
+		return ((uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24)) & 0x0FFFFFFF;
+	}
+	const uint8_t *p = block + idx * 2;
+	return (uint32_t) p[0] | ((uint32_t) p[1] << 8);
+}
+
+
+
+// ------------------------
+void ESPWebDAV::indexChain(uint32_t cluster, uint32_t skip, bool isFree, FreedRuns *freed)	{
+// ------------------------
+	// walk a cluster chain and mark its runs free or used in the extent index
+	// with freed the runs are only collected, for a chain not freed yet
+	// reads the FAT on the card, so call only after SdFat has synced its cache
+#if DAV_ENABLE_QUOTA
+	if(!_extents.isReady())
+		return;
+
+	FatVolume *vol = sd.vol();
+	uint32_t entriesPerBlock = (vol->fatType() == 32) ? 128 : 256;
+	uint32_t lastCluster = vol->clusterCount() + 1;
+	uint32_t cachedBlock = 0xFFFFFFFF;
+	uint32_t runStart = 0, runLength = 0;
+	uint8_t buf[512];
+
+	// end of chain and bad cluster marks are all past lastCluster
+	for(uint32_t guard = 0; cluster >= 2 && cluster <= lastCluster && guard < lastCluster; guard++)	{
+		if(skip)
+			skip--;
+		else if(runLength && (runStart + runLength == cluster))
+			runLength++;
+		else	{
+			if(runLength)
+				indexRun(runStart, runLength, isFree, freed);
+			runStart = cluster;
+			runLength = 1;
+		}
+
+		uint32_t block = vol->fatStartBlock() + cluster / entriesPerBlock;
+		if(block != cachedBlock)	{
+			if(!sd.card()->readBlock(block, buf))
+				break;
+			cachedBlock = block;
+		}
+		cluster = fatEntry(buf, cluster % entriesPerBlock);
+	}
+
+	if(runLength)
+		indexRun(runStart, runLength, isFree, freed);
+#endif
+}
+
+
+
+// ------------------------
+void ESPWebDAV::indexRun(uint32_t start, uint32_t length, bool isFree, FreedRuns *freed)	{
+// ------------------------
+	if(!freed)	{
+#if DAV_ENABLE_QUOTA
+		isFree ? _extents.release(start, length) : _extents.allocate(start, length);
+#endif
+		return;
+	}
+
+	// no room, the shortest goes; a run left out only makes the index miss it
+	uint8_t idx = freed->count;
+	if(idx == DAV_FREED_RUNS)	{
+		idx = 0;
+		for(uint8_t i = 1; i < DAV_FREED_RUNS; i++)
+			if(freed->runs[i].length < freed->runs[idx].length)
+				idx = i;
+		if(freed->runs[idx].length >= length)
+			return;
+	}
+	else
+		freed->count++;
+	freed->runs[idx].start = start;
+	freed->runs[idx].length = length;
+}
+
+
+
+// ------------------------
+void ESPWebDAV::releaseFreed(const FreedRuns *freed)	{
+// ------------------------
+#if DAV_ENABLE_QUOTA
+	for(uint8_t i = 0; i < freed->count; i++)
+		_extents.release(freed->runs[i].start, freed->runs[i].length);
+#endif
+}
+
+
+
+// ------------------------
+uint32_t ESPWebDAV::firstCluster(FatFile *file)	{
+// ------------------------
+	dir_t dir;
+	if(!file->dirEntry(&dir))
+		return 0;
+	return ((uint32_t) dir.firstClusterHigh << 16) | dir.firstClusterLow;
+}
+
+
+
+// ------------------------
+bool ESPWebDAV::hasContiguousRun(uint32_t numClusters)	{
+// ------------------------
+	// without an index (quota off, FAT pass failed) let createContiguous
+	// find out the slow way
+#if DAV_ENABLE_QUOTA
+	FreeExtent extent;
+	if(_extents.isReady())
+		return _extents.bestFit(numClusters, &extent);
+#endif
+	return true;
+}
+
+
+
+// ------------------------
+uint32_t ESPWebDAV::clustersFor(uint32_t numBytes)	{
+// ------------------------
+	return (numBytes + _clusterBytes - 1) / _clusterBytes;
+}
+
+
+
+// ------------------------
+uint32_t ESPWebDAV::fileClusters(FatFile *file)	{
+// ------------------------
+	if(!file->isDir())
+		return clustersFor(file->fileSize());
+
+	// directories carry no size, read the entries to find their length
+	uint8_t buf[32];
+	file->rewind();
+	while(file->read(buf, sizeof(buf)) > 0)
+		yield();
+	uint32_t dirLength = file->curPosition();
+	file->rewind();
+	return clustersFor(dirLength);
+}
+
+
+
+// ------------------------
+void ESPWebDAV::adjustFreeClusters(int32_t delta)	{
+// ------------------------
+	if(_freeClusters < 0)
+		return;
+	_freeClusters += delta;
+}
+
+
+
+// ------------------------
+bool ESPWebDAV::removeTracked(const char *path)	{
+// ------------------------
+	FatFile tFile;
+	if(!tFile.open(sd.vwd(), path, O_READ))
+		return false;
+
+	bool isDir = tFile.isDir();
+	uint32_t numClusters = fileClusters(&tFile);
+	uint32_t bgnCluster = firstCluster(&tFile);
+	tFile.close();
+
+	// the chain is gone once removed, read it first and release it after
+	FreedRuns freed;
+	freed.count = 0;
+	indexChain(bgnCluster, 0, true, &freed);
+
+	if(!(isDir ? sd.rmdir(path) : sd.remove(path)))
+		return false;
+
+	releaseFreed(&freed);
+	adjustFreeClusters(numClusters);
+	indexTouch(path);
+	return true;
+}
+
+
+
+// ------------------------
+bool ESPWebDAV::createContiguousTracked(FatFile *file, const char *path, uint32_t size)	{
+// ------------------------
+	if(!file->createContiguous(sd.vwd(), path, size))
+		return false;
+
+	uint32_t numClusters = clustersFor(size);
+	adjustFreeClusters(-(int32_t) numClusters);
+#if DAV_ENABLE_QUOTA
+	_extents.allocate(firstCluster(file), numClusters);
+#endif
+	return true;
+}
+
+
+
+// ------------------------
+bool ESPWebDAV::truncateTracked(FatFile *file, uint32_t length)	{
+// ------------------------
+	uint32_t numClusters = clustersFor(file->fileSize());
+	uint32_t numKept = clustersFor(length);
+
+	// clusters past the new end return to the pool once truncated
+	FreedRuns freed;
+	freed.count = 0;
+	indexChain(firstCluster(file), numKept, true, &freed);
+
+	if(!file->truncate(length))
+		return false;
+
+	releaseFreed(&freed);
+	adjustFreeClusters(numClusters - numKept);
+	return true;
+}
+
+
+
+// ------------------------
+void ESPWebDAV::trackWrittenFile(FatFile *file, uint32_t oldSize)	{
+// ------------------------
+	// file grown past oldSize by the file system, new clusters may be anywhere
+	uint32_t numOld = clustersFor(oldSize);
+	uint32_t numNew = fileClusters(file);
+	if(numNew <= numOld)
+		return;
+
+	adjustFreeClusters(-(int32_t) (numNew - numOld));
+	// without the bus the chain is read on the next request
+	if(_busLost)	{
+		_lostCluster = file->firstCluster();
+		_lostSkip = numOld;
+		return;
+	}
+	indexChain(firstCluster(file), numOld, false);
+}
+
+
+
+// ------------------------
+bool ESPWebDAV::mkdirTracked(const char *path)	{
+// ------------------------
+	// parents are created as well, each new directory takes one cluster
+	String dirPath = path;
+	if(dirPath.length() > 1 && dirPath.endsWith("/"))
+		dirPath.remove(dirPath.length() - 1);
+	int numCreated = 0;
+	int firstCreated = -1;
+	int idx = 0;
+	while(idx >= 0)	{
+		idx = dirPath.indexOf('/', idx + 1);
+		String partPath = (idx < 0) ? dirPath : dirPath.substring(0, idx);
+		if(partPath.length() && !partPath.equals("/") && !sd.exists(partPath.c_str()))	{
+			if(firstCreated < 0)
+				firstCreated = partPath.length();
+			numCreated++;
+		}
+	}
+
+	if(!sd.mkdir(path, true))
+		return false;
+
+	adjustFreeClusters(-numCreated);
+
+	// everything from the first missing parent down is new
+	for(idx = firstCreated; idx >= 0; idx = dirPath.indexOf('/', idx + 1))
+		indexTouch(dirPath.substring(0, idx).c_str());
+	if(firstCreated >= 0)
+		indexTouch(dirPath.c_str());
+
+	FatFile tFile;
+	if(tFile.open(sd.vwd(), path, O_READ))	{
+		indexChain(firstCluster(&tFile), 0, false);
+		tFile.close();
+	}
+	return true;
+}
+
+
+
+// ------------------------
+void ESPWebDAV::sendQuotaProps()	{
+// ------------------------
+	// RFC 4331, reported for the whole volume
+	if(!DAVConfig::quota || _freeClusters < 0)
+		return;
+
+	uint64_t freeBytes = (uint64_t) _freeClusters * _clusterBytes;
+	uint64_t usedBytes = (uint64_t) (sd.vol()->clusterCount() - _freeClusters) * _clusterBytes;
+
+	sendContent(F("<D:quota-available-bytes>"));
+	sendContent(formatUint64(freeBytes));
+	sendContent(F("</D:quota-available-bytes><D:quota-used-bytes>"));
+	sendContent(formatUint64(usedBytes));
+	sendContent(F("</D:quota-used-bytes>"));
+}
@@ -1,5 +1,17 @@
-#include <ESP8266WiFi.h>
+#if defined(ESP32)
+	#include <WiFi.h>
+#else
+	#include <ESP8266WiFi.h>
+#endif
 #include <SdFat.h>
+#include "ESPWebDAVConfig.h"
+#include "BlockPipeline.h"
+#include "FreeExtents.h"
+#include "SearchIndex.h"
+#include "GzipStream.h"
+#include "TarFormat.h"
+#include "UploadDigest.h"
+#include "BusArbiter.h"
 
 // debugging
 // #define DBG_PRINT(...) 		{ Serial.print(__VA_ARGS__); }
@@ -11,18 +23,86 @@
 // constants for WebServer
 #define CONTENT_LENGTH_UNKNOWN ((size_t) -1)
 #define CONTENT_LENGTH_NOT_SET ((size_t) -2)
-#define HTTP_MAX_POST_WAIT 		5000 
+// uploads are received under this name and replace the file once complete
+#define DAV_UPLOAD_SUFFIX		".davpart"
+// the card is read and written in fixed blocks
+#define DAV_BLOCK_SIZE			512
+// room for the chunk size line in front of a chunk buffer
+#define DAV_CHUNK_HEAD			8
 
 enum ResourceType { RESOURCE_NONE, RESOURCE_FILE, RESOURCE_DIR };
 enum DepthType { DEPTH_NONE, DEPTH_CHILD, DEPTH_ALL };
+enum SendMode { SEND_SMALL, SEND_BULK };
+// HOLD: header and body are kept back until the body size decides
+enum CompressState { COMPRESS_OFF, COMPRESS_HOLD, COMPRESS_ON };
+// header a digest came in, the reply uses the same one
+enum DigestField { FIELD_CONTENT_MD5, FIELD_DIGEST, FIELD_REPR_DIGEST };
+
+// card start, stepped through between requests, served from WARM_STALE on
+enum WarmState { WARM_MOUNT, WARM_FREE_SPACE, WARM_SEARCH, WARM_INDEX, WARM_STALE, WARM_ROOT, WARM_DONE };
+
+// startup timing, ms since init
+struct BootStats	{
+	uint32_t mountMs;			// card mounted
+	uint32_t readyMs;			// free space counted and filename index checked, requests served
+	uint32_t warmMs;			// root directory walked
+	uint32_t firstPropfindMs;	// first PROPFIND answered with 207
+	uint32_t mountTries;
+	uint32_t busyReplies;		// requests turned away while the card was starting
+};
+
+// counters for the response being sent
+struct SendStats	{
+	uint32_t bytes;
+	uint32_t stalls;			// write accepted nothing, waited for the send window
+	uint32_t retransmitWaits;	// window stayed closed beyond DAV_RETRANSMIT_WAIT
+	uint32_t waitMs;			// total time spent waiting for the window
+};
+
+// streamed body built piece by piece, each chunk goes out in one write
+struct ChunkBuffer	{
+	uint8_t buf[DAV_CHUNK_HEAD + DAVConfig::sendBuffer + 2];
+	size_t len;
+	bool ok;
+};
+
+// runs of a chain about to be freed, released in the index once it is
+#define DAV_FREED_RUNS			8
+struct FreedRuns	{
+	FreeExtent runs[DAV_FREED_RUNS];	// the longest ones, others are left out
+	uint8_t count;
+};
+
+// one row of an HTML directory page, the name is read again when it is sent
+struct IndexRow	{
+	char key[DAV_INDEX_KEY];	// lower case start of the name, sorts the page
+	uint32_t size;
+	uint16_t date;				// FAT last write date and time
+	uint16_t time;
+	uint16_t dirIndex;			// entry in the directory, to open it again
+	bool isDir;
+};
+
+typedef BlockRing<DAV_BLOCK_SIZE, DAV_PIPELINE_DEPTH> DAVRing;
+typedef BlockPipeline<DAVRing> DAVPipeline;
 
 
 class ESPWebDAV	{
 public:
+	ESPWebDAV() : _warmState(WARM_MOUNT), _warmWalk(NULL), _bus(NULL), _busLost(false), _lostCluster(0)	{}
+	// starts the listener, the card is mounted later by handleClient
 	bool init(int chipSelectPin, SPISettings spiSettings, int serverPort);
+	bool isCardReady()	{ return _warmState >= WARM_STALE; }
 	bool isClientWaiting();
 	void handleClient(String blank = "");
 	void rejectClient(String rejectMessage);
+	// card shared with another SPI master, set before init
+	void setBusArbiter(BusArbiter *bus)	{ _bus = bus; }
+#if DAV_USE_PIPELINE
+	const BlockRingStats& pipelineStats()	{ return _pipelineStats; }
+#endif
+	const SendStats& sendStats()	{ return _sendStats; }
+	const BootStats& bootStats()	{ return _bootStats; }
 	
 protected:
 	typedef void (ESPWebDAV::*THandlerFunction)(String);
@@ -32,31 +112,137 @@ protected:
 	void handleReject(String rejectMessage);
 	void handleRequest(String blank);
 	void handleOptions(ResourceType resource);
+	String allowHeader();
 	void handleLock(ResourceType resource);
 	void handleUnlock(ResourceType resource);
 	void handlePropPatch(ResourceType resource);
 	void handleProp(ResourceType resource);
 	void sendPropResponse(boolean recursing, FatFile *curFile);
+	void sendPropResponse(FatFile *curFile, const String& fullResPath);
 	void handleGet(ResourceType resource, bool isGet);
+	void handleArchive(ResourceType resource, bool isGet);
+	void tarEntry(ChunkBuffer *cb, FatFile *file, const char *name, bool isDir);
+	void handleIndex(bool isGet);
+	uint32_t readIndexPage(FatFile *dir, IndexRow *rows, uint32_t offset, uint32_t limit, bool *hasMore);
+	void sortIndexPage(FatFile *dir, IndexRow *rows, uint32_t numRows);
+	bool indexRowName(FatFile *dir, const IndexRow *row, char *buf, size_t bufSize);
+	void sendIndexRow(ChunkBuffer *cb, FatFile *dir, const IndexRow *row, const String& base);
+	String httpDate(uint16_t date, uint16_t time);
 	void handlePut(ResourceType resource);
-	void handleWriteError(String message, FatFile *wFile);
+	const char *receiveFile(const char *path, size_t contentLen, bool keepPartial = false);
+	const char *receiveContiguous(FatFile *nFile, size_t contentLen, size_t contBlocks);
+	const char *receiveFragmented(FatFile *nFile, const char *path, size_t contentLen);
+	bool receiveToFile(FatFile *nFile, size_t *numRemaining);
+	void handleRangeWrite(ResourceType resource);
+	void handleExtract(ResourceType resource);
+	bool tarMemberPath(const String& baseDir, const char *name, String *path);
+	bool skipBody(size_t len);
+	void setDigestHeader(DigestField field, bool wanted, const String& value);
+	DigestType pickDigest(const String& value, String *expected);
+	bool beginDigest();
+	bool checkDigest();
+#if DAV_ENABLE_DIGEST
+	void digestBlock(const uint8_t *data, size_t len)	{ _digest.update(data, len); }
+#else
+	void digestBlock(const uint8_t *, size_t)	{}
+#endif
+	bool parseContentRange(const String& value, size_t contentLen, uint32_t *offset, int32_t *total);
+	bool parseUpdateRange(const String& value, uint32_t fileSize, size_t contentLen, uint32_t *offset);
+	const char *receiveRange(FatFile *nFile, uint32_t offset, size_t contentLen);
+	void sendUploadOffset();
 	void handleDirectoryCreate(ResourceType resource);
 	void handleMove(ResourceType resource);
 	void handleDelete(ResourceType resource);
+	void handleSearch(ResourceType resource);
+	void handleQuery(ResourceType resource);
+	static bool searchHitProp(void *ctx, const char *path, const IndexRecord *rec);
+	static bool searchHitLine(void *ctx, const char *path, const IndexRecord *rec);
+	static void applyRange(const char *op, uint32_t value, uint32_t *minValue, uint32_t *maxValue);
+	uint32_t parseHttpDate(const String& date);
+	void indexTouch(const char *path);
+	void indexTouchTree(const char *path);
+	void syncSearchIndex();
+	bool stepSearchIndex();
+	bool searchUnavailable();
+	int32_t indexFileClusters(bool isFree);
+
+	// card start
+	void warmUp();
+	bool warmStep();
+	bool warmStale();
+	bool warmRoot();
+
+	// free space accounting
+	bool initFreeSpace();
+	bool scanFreeSpace(uint32_t maxBlocks);
+	uint32_t fatEntry(const uint8_t *block, uint32_t idx);
+	void indexChain(uint32_t cluster, uint32_t skip, bool isFree, FreedRuns *freed = NULL);
+	void indexRun(uint32_t start, uint32_t length, bool isFree, FreedRuns *freed);
+	void releaseFreed(const FreedRuns *freed);
+	uint32_t firstCluster(FatFile *file);
+	bool hasContiguousRun(uint32_t numClusters);
+	void trackWrittenFile(FatFile *file, uint32_t oldSize = 0);
+	uint32_t clustersFor(uint32_t numBytes);
+	uint32_t fileClusters(FatFile *file);
+	void adjustFreeClusters(int32_t delta);
+	bool removeTracked(const char *path);
+	bool createContiguousTracked(FatFile *file, const char *path, uint32_t size);
+	bool truncateTracked(FatFile *file, uint32_t length);
+	bool mkdirTracked(const char *path);
+	void sendQuotaProps();
+
+	// shared bus
+	bool acquireBus();
+	void releaseBus();
+	bool busYield(FatFile *file);
+	void sendBusy(const String& message);
+
+	// pipelined transfers
+	struct PipeTransfer	{
+		ESPWebDAV *dav;
+		FatFile *file;
+		size_t remaining;
+		bool timedOut;
+	};
+	bool runPipeline(DAVPipeline::Producer producer, DAVPipeline::Consumer consumer, PipeTransfer *xfer);
+	static size_t pipeFileRead(void *ctx, uint8_t *data, size_t size);
+	static bool pipeClientWrite(void *ctx, const uint8_t *data, size_t length);
+	static size_t pipeClientRead(void *ctx, uint8_t *data, size_t size);
+	static bool pipeCardWrite(void *ctx, const uint8_t *data, size_t length);
+	static bool pipeFileWrite(void *ctx, const uint8_t *data, size_t length);
 
 	// Sections are copied from ESP8266Webserver
 	String getMimeType(String path);
 	String urlDecode(const String& text);
+	String urlEncode(const String& text);
+	String htmlEscape(const String& text);
 	String urlToUri(String url);
+	String formatUint64(uint64_t value);
+	String queryArg(const char *name);
+	String readBody(size_t maxLen);
+	int findElement(const String& xml, const char *name, int from);
+	String elementText(const String& xml, int idx);
 	bool parseRequest();
 	void sendHeader(const String& name, const String& value, bool first = false);
 	void send(String code, const char* content_type, const String& content);
 	void _prepareHeader(String& response, String code, const char* content_type, size_t contentLength);
 	void sendContent(const String& content);
 	void sendContent_P(PGM_P content);
+	void sendChunk(const uint8_t *buf, size_t len);
+	void chunkPut(ChunkBuffer *cb, const uint8_t *data, size_t len);
+	bool chunkFlush(ChunkBuffer *cb);
+	void compressResponse();
+	void startCompression();
+	void finishCompression();
+	void sendHeldHeader();
+	static void gzipSink(void *ctx, const uint8_t *data, size_t len);
 	void setContentLength(size_t len);
 	size_t readBytesWithTimeout(uint8_t *buf, size_t bufSize);
 	size_t readBytesWithTimeout(uint8_t *buf, size_t bufSize, size_t numToRead);
+	size_t readFull(uint8_t *buf, size_t len);
+	void setSendMode(SendMode mode);
+	size_t sendBytes(const uint8_t *buf, size_t len);
+	bool waitForSendWindow();
 	
 	
 	// variables pertaining to current most HTTP request being serviced
@@ -66,14 +252,78 @@ protected:
 	WiFiClient 	client;
 	String 		method;
 	String 		uri;
+	String 		query;
 	String 		contentLengthHeader;
 	String 		depthHeader;
 	String 		hostHeader;
 	String		destinationHeader;
+	String		acceptHeader;
+	String		acceptEncodingHeader;
+	String		contentRangeHeader;
+	String		contentTypeHeader;
+	String		digestHeader;
+	DigestField	digestField;
+	bool		digestWanted;
+	String		updateRangeHeader;
 
 	String 		_responseHeaders;
 	bool		_chunked;
 	int			_contentLength;
+
+	CompressState	_compress;
+	GzipStream	*_gzip;
+#if DAV_ENABLE_GZIP
+	String		_heldCode;
+	String		_heldType;
+	String		_heldBody;
+#endif
+
+#if DAV_ENABLE_DIGEST
+	UploadDigest	_digest;
+	String		_digestExpected;
+#endif
+
+#if DAV_USE_PIPELINE
+	BlockRingStats	_pipelineStats;
+#endif
+	SendStats	_sendStats;
+
+	// free clusters on the volume, -1 until counted
+	int32_t		_freeClusters;
+	uint32_t	_clusterBytes;
+#if DAV_ENABLE_QUOTA
+	// free runs on the volume, built by the same FAT pass
+	FreeExtentIndex	_extents;
+#endif
+	uint32_t	_scanBlock;
+	uint32_t	_scanFree;
+
+#if DAV_ENABLE_SEARCH
+	SearchIndex	_search;
+	// clusters of the index files before a merge or rebuild that is in progress
+	int32_t		_indexClusters;
+#endif
+
+	// card start
+	int			_chipSelectPin;
+	SPISettings	_spiSettings;
+	WarmState	_warmState;
+	uint32_t	_bootStart;
+	uint32_t	_mountTried;
+	// walk of the card for stale uploads
+	TreeWalk	*_warmWalk;
+	// root directory position of the walk
+	uint32_t	_warmPos;
+	BootStats	_bootStats;
+
+	BusArbiter	*_bus;
+	// handed over and not taken back, the card is off limits until the next request
+	bool		_busLost;
+	// chain of a file grown before the bus was lost, for the extent index
+	uint32_t	_lostCluster;
+	uint32_t	_lostSkip;
+	// upload whose temporary file could not be cut to what arrived
+	String		_lostUpload;
 };
 
 
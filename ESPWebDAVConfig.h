@@ -0,0 +1,202 @@
+#ifndef ESPWEBDAV_CONFIG_H
+#define ESPWEBDAV_CONFIG_H
+
+// Build configuration of the server.
+// Every DAV_ value can be set with a compiler flag (-DDAV_ENABLE_TAR=0) or
+// defined before ESPWebDAV.h is included. The code reads them through
+// DAVConfig, whose constants fold away: a feature switched off leaves an
+// if(false) at its call sites and --gc-sections drops what it guarded.
+// Members that hold state for a feature are under #if as well, so one that
+// is off costs no RAM either: the search index with its pending paths
+// (DAV_ENABLE_SEARCH), the SHA-256 state, block and MD5Builder
+// (DAV_ENABLE_DIGEST), the free run index (DAV_ENABLE_QUOTA), the held
+// header and body Strings (DAV_ENABLE_GZIP) and the ring counters
+// behind pipelineStats() (DAV_USE_PIPELINE).
+//
+// A class template over a traits struct with if constexpr would do the
+// same, but the ESP8266 core 2.4 compiler is gcc 4.8 (C++11), the server
+// spans several translation units and sketches declare a plain ESPWebDAV.
+// Constant folding gives the same binary without moving it into headers.
+
+#include <stddef.h>
+#include <stdint.h>
+
+// DAV_LEAN: optional features default to off, for small heap and flash
+#ifdef DAV_LEAN
+	#define DAV_OPTIONAL		0
+#else
+	#define DAV_OPTIONAL		1
+#endif
+
+// methods Windows Explorer needs, on unless switched off one by one
+#ifndef DAV_ENABLE_LOCK
+	#define DAV_ENABLE_LOCK			1
+#endif
+#ifndef DAV_ENABLE_PROPPATCH
+	#define DAV_ENABLE_PROPPATCH	1
+#endif
+#ifndef DAV_ENABLE_MKCOL
+	#define DAV_ENABLE_MKCOL		1
+#endif
+#ifndef DAV_ENABLE_MOVE
+	#define DAV_ENABLE_MOVE			1
+#endif
+#ifndef DAV_ENABLE_DELETE
+	#define DAV_ENABLE_DELETE		1
+#endif
+
+// optional features
+#ifndef DAV_ENABLE_QUOTA
+	#define DAV_ENABLE_QUOTA		DAV_OPTIONAL
+#endif
+#ifndef DAV_ENABLE_SEARCH
+	#define DAV_ENABLE_SEARCH		DAV_OPTIONAL
+#endif
+#ifndef DAV_ENABLE_GZIP
+	#define DAV_ENABLE_GZIP			DAV_OPTIONAL
+#endif
+#ifndef DAV_ENABLE_TAR
+	#define DAV_ENABLE_TAR			DAV_OPTIONAL
+#endif
+#ifndef DAV_ENABLE_RANGE_WRITE
+	#define DAV_ENABLE_RANGE_WRITE	DAV_OPTIONAL
+#endif
+#ifndef DAV_ENABLE_DIGEST
+	#define DAV_ENABLE_DIGEST		DAV_OPTIONAL
+#endif
+#ifndef DAV_ENABLE_INDEX
+	#define DAV_ENABLE_INDEX		DAV_OPTIONAL
+#endif
+#ifndef DAV_USE_PIPELINE
+	#define DAV_USE_PIPELINE		0
+#endif
+
+// sizes, boards with more RAM get deeper rings and bigger tables
+#if defined(ESP32)
+	#define DAV_BOARD_SCALE			2
+#else
+	#define DAV_BOARD_SCALE			1
+#endif
+
+// blocks in flight between socket and card when pipelined
+#ifndef DAV_PIPELINE_DEPTH
+	#define DAV_PIPELINE_DEPTH		(4 * DAV_BOARD_SCALE)
+#endif
+// send path: bulk writes are sized to whole TCP segments
+#ifndef DAV_SEND_SEGMENT
+	#ifdef TCP_MSS
+		#define DAV_SEND_SEGMENT	TCP_MSS
+	#else
+		#define DAV_SEND_SEGMENT	1460
+	#endif
+#endif
+#ifndef DAV_SEND_BUFFER
+	#define DAV_SEND_BUFFER			(DAV_SEND_SEGMENT * DAV_BOARD_SCALE)
+#endif
+// LOCK request bodies, longer ones are cut
+#ifndef DAV_LOCK_BUFFER
+	#define DAV_LOCK_BUFFER			1024
+#endif
+// largest XML request body parsed
+#ifndef DAV_MAX_BODY
+	#define DAV_MAX_BODY			1024
+#endif
+// per member lines in a tar extract reply, counts follow
+#ifndef DAV_EXTRACT_SUMMARY
+	#define DAV_EXTRACT_SUMMARY		2048
+#endif
+// bodies shorter than this go out uncompressed
+#ifndef DAV_GZIP_THRESHOLD
+	#define DAV_GZIP_THRESHOLD		1024
+#endif
+// deflate history, two of these plus the hash table are allocated per gzip,
+// 16384 at most
+#ifndef DAV_GZIP_WINDOW
+	#define DAV_GZIP_WINDOW			(1024 * DAV_BOARD_SCALE)
+#endif
+// free cluster runs remembered, indexed by the FAT pass that counts free
+// space: with DAV_ENABLE_QUOTA off there is no index and every upload
+// tries a contiguous file first
+#ifndef DAV_FREE_EXTENTS
+	#define DAV_FREE_EXTENTS		(32 * DAV_BOARD_SCALE)
+#endif
+// rows of an HTML directory page, default and largest ?limit=
+#ifndef DAV_INDEX_PAGE
+	#define DAV_INDEX_PAGE			(50 * DAV_BOARD_SCALE)
+#endif
+// search index changes collected before a merge
+#ifndef DAV_SEARCH_PENDING
+	#define DAV_SEARCH_PENDING		(16 * DAV_BOARD_SCALE)
+#endif
+
+// timeouts in ms
+#ifndef HTTP_MAX_POST_WAIT
+	#define HTTP_MAX_POST_WAIT		5000
+#endif
+#ifndef HTTP_MAX_SEND_WAIT
+	#define HTTP_MAX_SEND_WAIT		5000
+#endif
+// window closed this long means the stack is waiting on a retransmit
+#ifndef DAV_RETRANSMIT_WAIT
+	#define DAV_RETRANSMIT_WAIT		200
+#endif
+
+// card start: longest slice of work per idle handleClient, FAT blocks
+// counted between clock checks and wait before a failed mount is retried
+#ifndef DAV_WARM_SLICE
+	#define DAV_WARM_SLICE			20
+#endif
+#ifndef DAV_WARM_BLOCKS
+	#define DAV_WARM_BLOCKS			8
+#endif
+#ifndef DAV_MOUNT_RETRY
+	#define DAV_MOUNT_RETRY			1000
+#endif
+
+// bus shared with another master: longest hold, gap left between leases,
+// quiet needed before a transfer resumes and how long it waits for that
+#ifndef DAV_BUS_LEASE
+	#define DAV_BUS_LEASE			250
+#endif
+#ifndef DAV_BUS_GAP
+	#define DAV_BUS_GAP				10
+#endif
+#ifndef DAV_BUS_QUIET
+	#define DAV_BUS_QUIET			200
+#endif
+#ifndef DAV_BUS_WAIT
+	#define DAV_BUS_WAIT			5000
+#endif
+
+
+struct DAVConfig	{
+	static constexpr bool lock = DAV_ENABLE_LOCK;
+	static constexpr bool propPatch = DAV_ENABLE_PROPPATCH;
+	static constexpr bool mkcol = DAV_ENABLE_MKCOL;
+	static constexpr bool move = DAV_ENABLE_MOVE;
+	static constexpr bool remove = DAV_ENABLE_DELETE;
+	static constexpr bool quota = DAV_ENABLE_QUOTA;
+	static constexpr bool search = DAV_ENABLE_SEARCH;
+	static constexpr bool gzip = DAV_ENABLE_GZIP;
+	static constexpr bool tar = DAV_ENABLE_TAR;
+	static constexpr bool rangeWrite = DAV_ENABLE_RANGE_WRITE;
+	static constexpr bool digest = DAV_ENABLE_DIGEST;
+	static constexpr bool htmlIndex = DAV_ENABLE_INDEX;
+	static constexpr bool pipeline = DAV_USE_PIPELINE;
+
+	static constexpr size_t sendBuffer = DAV_SEND_BUFFER;
+	static constexpr size_t lockBuffer = DAV_LOCK_BUFFER;
+	static constexpr size_t maxBody = DAV_MAX_BODY;
+	static constexpr size_t extractSummary = DAV_EXTRACT_SUMMARY;
+	static constexpr size_t gzipThreshold = DAV_GZIP_THRESHOLD;
+	static constexpr uint32_t indexPage = DAV_INDEX_PAGE;
+
+	static constexpr uint32_t postWait = HTTP_MAX_POST_WAIT;
+	static constexpr uint32_t sendWait = HTTP_MAX_SEND_WAIT;
+	static constexpr uint32_t retransmitWait = DAV_RETRANSMIT_WAIT;
+	static constexpr uint32_t warmSlice = DAV_WARM_SLICE;
+	static constexpr uint32_t warmBlocks = DAV_WARM_BLOCKS;
+	static constexpr uint32_t mountRetry = DAV_MOUNT_RETRY;
+};
+
+#endif
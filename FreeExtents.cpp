@@ -0,0 +1,179 @@
+#include <string.h>
+#include "FreeExtents.h"
+
+
+// ------------------------
+FreeExtentIndex::FreeExtentIndex()	{
+// ------------------------
+	clear();
+}
+
+
+
+// ------------------------
+void FreeExtentIndex::clear()	{
+// ------------------------
+	numExtents = 0;
+	ready = false;
+	runStart = 0;
+	runLength = 0;
+}
+
+
+
+// ------------------------
+void FreeExtentIndex::scanCluster(uint32_t cluster, bool isFree)	{
+// ------------------------
+	if(isFree)	{
+		// extend the current run or start a new one
+		if(runLength && (runStart + runLength == cluster))	{
+			runLength++;
+			return;
+		}
+		insert(runStart, runLength);
+		runStart = cluster;
+		runLength = 1;
+	}
+	else if(runLength)	{
+		insert(runStart, runLength);
+		runLength = 0;
+	}
+}
+
+
+
+// ------------------------
+void FreeExtentIndex::endScan()	{
+// ------------------------
+	insert(runStart, runLength);
+	runLength = 0;
+	ready = true;
+}
+
+
+
+// ------------------------
+bool FreeExtentIndex::bestFit(uint32_t numClusters, FreeExtent *extent)	{
+// ------------------------
+	int idx = lowerBound(numClusters);
+	if(idx >= numExtents)
+		return false;
+
+	*extent = extents[idx];
+	return true;
+}
+
+
+
+// ------------------------
+uint32_t FreeExtentIndex::largest()	{
+// ------------------------
+	return numExtents ? extents[numExtents - 1].length : 0;
+}
+
+
+
+// ------------------------
+void FreeExtentIndex::allocate(uint32_t start, uint32_t length)	{
+// ------------------------
+	uint32_t end = start + length;
+	bool found = true;
+
+	// cut the range out of every run it overlaps, keep what is left on either side
+	while(found)	{
+		found = false;
+		for(int i = 0; i < numExtents; i++)	{
+			FreeExtent ext = extents[i];
+			uint32_t extEnd = ext.start + ext.length;
+			if(ext.start >= end || extEnd <= start)
+				continue;
+
+			removeAt(i);
+			if(ext.start < start)
+				insert(ext.start, start - ext.start);
+			if(extEnd > end)
+				insert(end, extEnd - end);
+			found = true;
+			break;
+		}
+	}
+}
+
+
+
+// ------------------------
+void FreeExtentIndex::release(uint32_t start, uint32_t length)	{
+// ------------------------
+	uint32_t end = start + length;
+	bool found = true;
+
+	// merge with touching or overlapping runs
+	while(found)	{
+		found = false;
+		for(int i = 0; i < numExtents; i++)	{
+			FreeExtent ext = extents[i];
+			uint32_t extEnd = ext.start + ext.length;
+			if(ext.start > end || extEnd < start)
+				continue;
+
+			removeAt(i);
+			if(ext.start < start)
+				start = ext.start;
+			if(extEnd > end)
+				end = extEnd;
+			found = true;
+			break;
+		}
+	}
+
+	insert(start, end - start);
+}
+
+
+
+// ------------------------
+void FreeExtentIndex::insert(uint32_t start, uint32_t length)	{
+// ------------------------
+	if(length == 0)
+		return;
+
+	// full: the smallest run makes room
+	if(numExtents == DAV_FREE_EXTENTS)	{
+		if(length <= extents[0].length)
+			return;
+		removeAt(0);
+	}
+
+	int idx = lowerBound(length);
+	memmove(&extents[idx + 1], &extents[idx], (numExtents - idx) * sizeof(FreeExtent));
+	extents[idx].start = start;
+	extents[idx].length = length;
+	numExtents++;
+}
+
+
+
+// ------------------------
+void FreeExtentIndex::removeAt(int idx)	{
+// ------------------------
+	numExtents--;
+	memmove(&extents[idx], &extents[idx + 1], (numExtents - idx) * sizeof(FreeExtent));
+}
+
+
+
+// ------------------------
+int FreeExtentIndex::lowerBound(uint32_t length)	{
+// ------------------------
+	// first run at least length long
+	int lo = 0;
+	int hi = numExtents;
+	while(lo < hi)	{
+		int mid = (lo + hi) / 2;
+		if(extents[mid].length < length)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
@@ -0,0 +1,54 @@
+#ifndef FREE_EXTENTS_H
+#define FREE_EXTENTS_H
+
+// In-RAM index of free cluster runs, kept sorted by length.
+// Built from one pass over the FAT, then patched as clusters are
+// allocated and released. Bounded: when full the smallest runs are dropped,
+// so the index may miss small runs but never reports a run that is too short.
+// No SdFat dependency, so it builds on the host as well.
+
+#include <stddef.h>
+#include <stdint.h>
+#include "ESPWebDAVConfig.h"
+
+
+struct FreeExtent	{
+	uint32_t start;		// first cluster
+	uint32_t length;	// number of clusters
+};
+
+
+class FreeExtentIndex	{
+public:
+	FreeExtentIndex();
+	void clear();
+
+	// building: feed every cluster in ascending order, then endScan
+	void scanCluster(uint32_t cluster, bool isFree);
+	void endScan();
+	bool isReady()	{ return ready; }
+
+	// smallest run holding at least numClusters, false if none is indexed
+	bool bestFit(uint32_t numClusters, FreeExtent *extent);
+	uint32_t largest();
+	uint8_t count()	{ return numExtents; }
+
+	// clusters taken from / returned to the free pool
+	void allocate(uint32_t start, uint32_t length);
+	void release(uint32_t start, uint32_t length);
+
+private:
+	void insert(uint32_t start, uint32_t length);
+	void removeAt(int idx);
+	int lowerBound(uint32_t length);
+
+	FreeExtent extents[DAV_FREE_EXTENTS];
+	uint8_t numExtents;
+	bool ready;
+
+	// run being collected during the scan
+	uint32_t runStart;
+	uint32_t runLength;
+};
+
+#endif
@@ -0,0 +1,251 @@
+#include <string.h>
+#include "GzipStream.h"
+
+#define MIN_MATCH		3
+#define MAX_MATCH		258
+// enough data ahead to find the longest match
+#define MIN_LOOKAHEAD	(MAX_MATCH + MIN_MATCH + 1)
+
+// deflate length and distance symbols, RFC 1951 3.2.5
+static const uint16_t lengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const uint8_t lengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const uint16_t distBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+static const uint8_t distExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+// CRC-32 a nibble at a time
+static const uint32_t crcTable[16] = {
+	0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+	0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c, 0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c
+};
+
+
+// ------------------------
+GzipStream::GzipStream(Sink sink, void *ctx) : sink(sink), ctx(ctx)	{
+// ------------------------
+	memset(head, 0, sizeof(head));
+	strStart = lookahead = 0;
+	outLen = 0;
+	bitBuf = 0;
+	bitCount = 0;
+	crc = 0xFFFFFFFF;
+	inSize = outSize = 0;
+
+	// gzip member header: deflate, no flags, no time, unknown OS
+	static const uint8_t gzipHeader[10] = { 0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 0xff };
+	for(size_t i = 0; i < sizeof(gzipHeader); i++)
+		putByte(gzipHeader[i]);
+
+	// one open ended block with fixed codes
+	putBits(0, 1);
+	putBits(1, 2);
+}
+
+
+
+// ------------------------
+void GzipStream::write(const uint8_t *data, size_t len)	{
+// ------------------------
+	inSize += len;
+	for(size_t i = 0; i < len; i++)	{
+		crc ^= data[i];
+		crc = (crc >> 4) ^ crcTable[crc & 15];
+		crc = (crc >> 4) ^ crcTable[crc & 15];
+	}
+
+	while(len)	{
+		if(strStart + lookahead == sizeof(window))
+			slide();
+
+		size_t numCopy = sizeof(window) - (strStart + lookahead);
+		if(numCopy > len)
+			numCopy = len;
+		memcpy(window + strStart + lookahead, data, numCopy);
+		lookahead += numCopy;
+		data += numCopy;
+		len -= numCopy;
+
+		deflate(false);
+	}
+}
+
+
+
+// ------------------------
+void GzipStream::finish()	{
+// ------------------------
+	deflate(true);
+
+	// end the open block, then an empty final block
+	putSymbol(256);
+	putBits(1, 1);
+	putBits(1, 2);
+	putSymbol(256);
+	if(bitCount)
+		putByte(bitBuf);
+	bitBuf = 0;
+	bitCount = 0;
+
+	// trailer: CRC-32 and length, little endian
+	uint32_t crcOut = ~crc;
+	for(int i = 0; i < 4; i++)
+		putByte(crcOut >> (8 * i));
+	for(int i = 0; i < 4; i++)
+		putByte(inSize >> (8 * i));
+	flushOut();
+}
+
+
+
+// ------------------------
+void GzipStream::deflate(bool flush)	{
+// ------------------------
+	// keep enough lookahead for a full match unless this is the end
+	while(lookahead && (flush || lookahead >= MIN_LOOKAHEAD))	{
+		size_t matchLen = 0;
+		size_t matchDist = 0;
+
+		if(lookahead >= MIN_MATCH)	{
+			uint16_t h = hash(strStart);
+			size_t candidate = head[h];
+			head[h] = strStart + 1;
+
+			if(candidate)	{
+				candidate--;
+				size_t maxLen = (lookahead < MAX_MATCH) ? lookahead : MAX_MATCH;
+				size_t len = 0;
+				while(len < maxLen && window[candidate + len] == window[strStart + len])
+					len++;
+				if(len >= MIN_MATCH)	{
+					matchLen = len;
+					matchDist = strStart - candidate;
+				}
+			}
+		}
+
+		if(matchLen)	{
+			putMatch(matchLen, matchDist);
+			// positions inside the match become candidates for later data
+			for(size_t i = 1; i < matchLen && lookahead - i >= MIN_MATCH; i++)
+				head[hash(strStart + i)] = strStart + i + 1;
+			strStart += matchLen;
+			lookahead -= matchLen;
+		}
+		else	{
+			putLiteral(window[strStart]);
+			strStart++;
+			lookahead--;
+		}
+	}
+}
+
+
+
+// ------------------------
+void GzipStream::slide()	{
+// ------------------------
+	// upper half becomes history, positions move down with it
+	memmove(window, window + DAV_GZIP_WINDOW, DAV_GZIP_WINDOW);
+	strStart -= DAV_GZIP_WINDOW;
+	for(size_t i = 0; i < (1 << DAV_GZIP_HASH_BITS); i++)
+		head[i] = (head[i] > DAV_GZIP_WINDOW) ? head[i] - DAV_GZIP_WINDOW : 0;
+}
+
+
+
+// ------------------------
+uint16_t GzipStream::hash(size_t pos)	{
+// ------------------------
+	return ((window[pos] << 6) ^ (window[pos + 1] << 3) ^ window[pos + 2]) & ((1 << DAV_GZIP_HASH_BITS) - 1);
+}
+
+
+
+// ------------------------
+void GzipStream::putLiteral(uint8_t c)	{
+// ------------------------
+	putSymbol(c);
+}
+
+
+
+// ------------------------
+void GzipStream::putSymbol(uint16_t sym)	{
+// ------------------------
+	// fixed literal/length code, RFC 1951 3.2.6
+	if(sym < 144)
+		putCode(0x30 + sym, 8);
+	else if(sym < 256)
+		putCode(0x190 + sym - 144, 9);
+	else if(sym < 280)
+		putCode(sym - 256, 7);
+	else
+		putCode(0xC0 + sym - 280, 8);
+}
+
+
+
+// ------------------------
+void GzipStream::putMatch(size_t len, size_t dist)	{
+// ------------------------
+	int code = 0;
+	while(code < 28 && lengthBase[code + 1] <= len)
+		code++;
+	putSymbol(257 + code);
+	putBits(len - lengthBase[code], lengthExtra[code]);
+
+	code = 0;
+	while(code < 29 && distBase[code + 1] <= dist)
+		code++;
+	putCode(code, 5);
+	putBits(dist - distBase[code], distExtra[code]);
+}
+
+
+
+// ------------------------
+void GzipStream::putCode(uint16_t code, uint8_t numBits)	{
+// ------------------------
+	// Huffman codes go out most significant bit first
+	uint16_t reversed = 0;
+	for(uint8_t i = 0; i < numBits; i++)	{
+		reversed = (reversed << 1) | (code & 1);
+		code >>= 1;
+	}
+	putBits(reversed, numBits);
+}
+
+
+
+// ------------------------
+void GzipStream::putBits(uint32_t value, uint8_t numBits)	{
+// ------------------------
+	bitBuf |= value << bitCount;
+	bitCount += numBits;
+	while(bitCount >= 8)	{
+		putByte(bitBuf);
+		bitBuf >>= 8;
+		bitCount -= 8;
+	}
+}
+
+
+
+// ------------------------
+void GzipStream::putByte(uint8_t b)	{
+// ------------------------
+	out[outLen++] = b;
+	if(outLen == sizeof(out))
+		flushOut();
+}
+
+
+
+// ------------------------
+void GzipStream::flushOut()	{
+// ------------------------
+	if(!outLen)
+		return;
+	sink(ctx, out, outLen);
+	outSize += outLen;
+	outLen = 0;
+}
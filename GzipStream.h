@@ -0,0 +1,66 @@
+#ifndef GZIP_STREAM_H
+#define GZIP_STREAM_H
+
+// Streaming gzip compressor with a small footprint.
+// LZ77 over a short window with one hash candidate per position and the
+// fixed Huffman codes of deflate, so no tables are built or sent. Good on
+// repetitive text like WebDAV XML, about 3.5KB of RAM in total.
+// No Arduino dependencies, so it builds on the host as well.
+
+#include <stddef.h>
+#include <stdint.h>
+#include "ESPWebDAVConfig.h"
+
+#define DAV_GZIP_HASH_BITS		9
+
+// matches reach back across both window halves, deflate allows 32KB and
+// head[] keeps positions + 1 in 16 bits
+static_assert(2 * DAV_GZIP_WINDOW <= 32768, "DAV_GZIP_WINDOW is at most 16384");
+#define DAV_GZIP_OUT			256
+
+
+class GzipStream	{
+public:
+	// receives the compressed stream piece by piece
+	typedef void (*Sink)(void *ctx, const uint8_t *data, size_t len);
+
+	GzipStream(Sink sink, void *ctx);
+	void write(const uint8_t *data, size_t len);
+	void finish();
+
+	uint32_t inputSize()	{ return inSize; }
+	uint32_t outputSize()	{ return outSize; }
+
+private:
+	void deflate(bool flush);
+	void slide();
+	uint16_t hash(size_t pos);
+	void putLiteral(uint8_t c);
+	void putSymbol(uint16_t sym);
+	void putMatch(size_t len, size_t dist);
+	void putCode(uint16_t code, uint8_t numBits);
+	void putBits(uint32_t value, uint8_t numBits);
+	void putByte(uint8_t b);
+	void flushOut();
+
+	Sink sink;
+	void *ctx;
+
+	// two window halves, the lower one is history once the upper fills
+	uint8_t window[2 * DAV_GZIP_WINDOW];
+	// last position + 1 seen for each hash, 0 for none
+	uint16_t head[1 << DAV_GZIP_HASH_BITS];
+	size_t strStart;
+	size_t lookahead;
+
+	uint8_t out[DAV_GZIP_OUT];
+	size_t outLen;
+	uint32_t bitBuf;
+	uint8_t bitCount;
+
+	uint32_t crc;
+	uint32_t inSize;
+	uint32_t outSize;
+};
+
+#endif
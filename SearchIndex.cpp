@@ -0,0 +1,959 @@
+#include <ctype.h>
+#include <string.h>
+#include "ESPWebDAV.h"
+
+static const char INDEX_MAGIC[8] = { 'D', 'A', 'V', 'I', 'D', 'X', '1', 0 };
+
+
+// ------------------------
+SearchIndex::SearchIndex()	{
+// ------------------------
+	sd = NULL;
+	build = NULL;
+	numPending = 0;
+	needsRebuild = true;
+	failed = false;
+}
+
+
+
+// ------------------------
+void SearchIndex::begin(SdFat *sdFat)	{
+// ------------------------
+	sd = sdFat;
+	// a rebuild cut off by a new mount starts over, its files belong to
+	// the old mount and are not closed
+	delete build;
+	build = NULL;
+	numPending = 0;
+	failed = false;
+	// rebuilt on the next flush when missing, torn or left dirty
+	needsRebuild = !validate();
+	DBG_PRINT("Search index "); DBG_PRINTLN(needsRebuild ? "stale" : "valid");
+}
+
+
+
+// ------------------------
+void SearchIndex::touch(const char *path)	{
+// ------------------------
+	// path was created, changed or removed, retry a failed rebuild too
+	// during a rebuild it is kept and merged once the rebuild is done
+	failed = false;
+	if((needsRebuild && !build) || isHiddenFile(baseName(path)))
+		return;
+
+	String entry = path;
+	if(entry.length() > 1 && entry.endsWith("/"))
+		entry.remove(entry.length() - 1);
+
+	if(covers(entry.c_str()))
+		return;
+
+	// no room, let the caller flush first
+	if(numPending == DAV_SEARCH_PENDING)
+		return invalidate();
+
+	if(numPending == 0)
+		markDirty();
+	pendingTree[numPending] = false;
+	pending[numPending++] = entry;
+}
+
+
+
+// ------------------------
+void SearchIndex::touchTree(const char *path)	{
+// ------------------------
+	// directory and everything below it changed, e.g. moved or unpacked
+	String entry = path;
+	if(entry.length() > 1 && entry.endsWith("/"))
+		entry.remove(entry.length() - 1);
+	if(entry.length() <= 1)
+		return invalidate();
+
+	failed = false;
+	if(needsRebuild && !build)
+		return;
+
+	String prefix = entry + "/";
+	for(uint8_t i = 0; i < numPending; )	{
+		if(isUnderTree(entry.c_str(), i) || (pendingTree[i] && pending[i].equalsIgnoreCase(entry)))
+			return;
+
+		// pending paths below it are merged into it
+		if(pending[i].equalsIgnoreCase(entry) || strncasecmp(pending[i].c_str(), prefix.c_str(), prefix.length()) == 0)	{
+			numPending--;
+			pending[i] = pending[numPending];
+			pendingTree[i] = pendingTree[numPending];
+			pending[numPending] = String();
+		}
+		else
+			i++;
+	}
+
+	if(numPending == DAV_SEARCH_PENDING)
+		return invalidate();
+
+	if(numPending == 0)
+		markDirty();
+	pendingTree[numPending] = true;
+	pending[numPending++] = entry;
+}
+
+
+
+// ------------------------
+bool SearchIndex::covers(const char *path)	{
+// ------------------------
+	// a touch of path takes no further pending slot
+	for(uint8_t i = 0; i < numPending; i++)
+		if(pending[i].equalsIgnoreCase(path) || isUnderTree(path, i))
+			return true;
+	return needsRebuild && !build;
+}
+
+
+
+// ------------------------
+bool SearchIndex::isUnderTree(const char *path, uint8_t i)	{
+// ------------------------
+	// path lies below pending directory i
+	if(!pendingTree[i])
+		return false;
+	const String &top = pending[i];
+	return strncasecmp(path, top.c_str(), top.length()) == 0 && path[top.length()] == '/';
+}
+
+
+
+// ------------------------
+void SearchIndex::invalidate()	{
+// ------------------------
+	// everything may have changed, e.g. a tree was unpacked into the root
+	// a rebuild under way may have walked past it, it starts over
+	failed = false;
+	if(!needsRebuild)
+		markDirty();
+	needsRebuild = true;
+	cancelBuild();
+}
+
+
+
+// ------------------------
+bool SearchIndex::flush()	{
+// ------------------------
+	while(flushStep())
+		;
+	return !failed;
+}
+
+
+
+// ------------------------
+bool SearchIndex::flushStep()	{
+// ------------------------
+	// a merge is done in one go
+	bool retVal = true;
+	if(needsRebuild)	{
+		if(!build && !beginBuild())
+			retVal = false;
+		else if(stepBuild())
+			return true;
+		else if((retVal = finishBuild()) && numPending)	{
+			// changes made while it ran are merged next
+			needsRebuild = false;
+			return true;
+		}
+	}
+	else if(numPending)
+		retVal = merge();
+
+	for(uint8_t i = 0; i < numPending; i++)
+		pending[i] = String();
+	numPending = 0;
+	needsRebuild = !retVal;
+	// do not retry on every request, wait for the next change
+	failed = !retVal;
+	return false;
+}
+
+
+
+// ------------------------
+bool SearchIndex::validate()	{
+// ------------------------
+	FatFile idx, paths;
+	IndexHeader hdr;
+
+	if(!idx.open(sd->vwd(), DAV_INDEX_FILE, O_READ))
+		return false;
+	bool retVal = (idx.read(&hdr, sizeof(hdr)) == sizeof(hdr)) &&
+		(memcmp(hdr.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) == 0) && hdr.clean &&
+		(idx.fileSize() == sizeof(hdr) + hdr.count * sizeof(IndexRecord));
+	idx.close();
+
+	if(!retVal || !paths.open(sd->vwd(), DAV_PATHS_FILE, O_READ))
+		return false;
+	retVal = (paths.fileSize() == hdr.pathsSize);
+	paths.close();
+	return retVal;
+}
+
+
+
+// ------------------------
+void SearchIndex::markDirty()	{
+// ------------------------
+	// unmerged changes would be lost on a power cut, rebuild if we see this at boot
+	FatFile idx;
+	IndexHeader hdr;
+	if(!idx.open(sd->vwd(), DAV_INDEX_FILE, O_RDWR))
+		return;
+	if(idx.read(&hdr, sizeof(hdr)) == sizeof(hdr) && idx.seekSet(0))	{
+		hdr.clean = 0;
+		idx.write(&hdr, sizeof(hdr));
+	}
+	idx.close();
+}
+
+
+
+// ------------------------
+bool SearchIndex::beginBuild()	{
+// ------------------------
+	DBG_PRINTLN("Rebuilding search index");
+	// changes so far are all in the walk
+	for(uint8_t i = 0; i < numPending; i++)
+		pending[i] = String();
+	numPending = 0;
+	sd->remove(DAV_INDEX_TMP);
+	sd->remove(DAV_PATHS_TMP);
+
+	build = new IndexBuild;
+	if(!build->idx.open(sd->vwd(), DAV_INDEX_TMP, O_RDWR | O_CREAT | O_TRUNC) ||
+			!build->paths.open(sd->vwd(), DAV_PATHS_TMP, O_RDWR | O_CREAT | O_TRUNC))	{
+		build->idx.close();
+		delete build;
+		build = NULL;
+		return false;
+	}
+
+	// header is filled in once the records are sorted
+	IndexHeader hdr;
+	memset(&hdr, 0, sizeof(hdr));
+	build->idx.write(&hdr, sizeof(hdr));
+
+	build->count = 0;
+	build->phase = BUILD_WALK;
+	build->tStart = millis();
+	build->walk.begin(sd, "");
+	return true;
+}
+
+
+
+// ------------------------
+bool SearchIndex::stepBuild()	{
+// ------------------------
+	// the tree walk, then a heap sort in place on the card like sortRecords
+	// false once the records are sorted
+	if(build->phase == BUILD_WALK)	{
+		FatFile child;
+		if(build->walk.next(&child))	{
+			addEntry(&child, build->walk.path(), &build->idx, &build->paths, &build->count);
+			child.close();
+			return true;
+		}
+		build->phase = BUILD_HEAP;
+		build->sortPos = build->count / 2;
+	}
+
+	if(build->phase == BUILD_HEAP)	{
+		if(build->sortPos > 0)	{
+			siftDown(&build->idx, --build->sortPos, build->count);
+			return true;
+		}
+		build->phase = BUILD_SORT;
+		build->sortPos = build->count ? build->count - 1 : 0;
+	}
+
+	if(build->sortPos == 0)
+		return false;
+
+	IndexRecord first, last;
+	readRecord(&build->idx, 0, &first);
+	readRecord(&build->idx, build->sortPos, &last);
+	writeRecord(&build->idx, 0, &last);
+	writeRecord(&build->idx, build->sortPos, &first);
+	siftDown(&build->idx, 0, build->sortPos);
+	build->sortPos--;
+	return true;
+}
+
+
+
+// ------------------------
+bool SearchIndex::finishBuild()	{
+// ------------------------
+	bool retVal = finish(&build->idx, &build->paths, build->count, DAV_PATHS_TMP, 0);
+	DBG_PRINT("Indexed "); DBG_PRINT(build->count); DBG_PRINT(" entries in: "); DBG_PRINT((millis() - build->tStart)/1000); DBG_PRINTLN(" sec");
+	delete build;
+	build = NULL;
+	return retVal;
+}
+
+
+
+// ------------------------
+void SearchIndex::cancelBuild()	{
+// ------------------------
+	// the temp files are removed when the next rebuild starts
+	if(!build)
+		return;
+	build->idx.close();
+	build->paths.close();
+	delete build;
+	build = NULL;
+	for(uint8_t i = 0; i < numPending; i++)
+		pending[i] = String();
+	numPending = 0;
+}
+
+
+
+// ------------------------
+void SearchIndex::walkTree(const char *top, FatFile *idx, FatFile *paths, uint32_t *count)	{
+// ------------------------
+	// a record for everything below top
+	TreeWalk *walk = new TreeWalk;
+	FatFile child;
+	walk->begin(sd, top);
+	while(walk->next(&child))	{
+		addEntry(&child, walk->path(), idx, paths, count);
+		child.close();
+		yield();
+	}
+	delete walk;
+}
+
+
+
+// ------------------------
+void SearchIndex::addEntry(FatFile *child, const char *path, FatFile *idx, FatFile *paths, uint32_t *count)	{
+// ------------------------
+	IndexRecord rec;
+	if(!isHiddenFile(baseName(path)) && makeRecord(child, path, paths, &rec) &&
+			idx->write(&rec, sizeof(rec)) == sizeof(rec))
+		(*count)++;
+}
+
+
+
+// ------------------------
+bool SearchIndex::makeRecord(FatFile *file, const char *path, FatFile *paths, IndexRecord *rec)	{
+// ------------------------
+	// record for file, its path is appended to the paths file
+	dir_t dir;
+	if(!file->dirEntry(&dir))
+		return false;
+
+	makeKey(baseName(path), rec->key);
+	rec->size = file->isDir() ? 0 : file->fileSize();
+	rec->mtime = fatToEpoch(dir.lastWriteDate, dir.lastWriteTime);
+	rec->pathOffset = paths->fileSize() | (file->isDir() ? DAV_INDEX_DIR : 0);
+
+	size_t len = strlen(path) + 1;
+	return paths->write(path, len) == (int) len;
+}
+
+
+
+// ------------------------
+bool SearchIndex::merge()	{
+// ------------------------
+	// one sequential pass: old records minus the pending paths, plus their fresh records
+	FatFile oldIdx, idx, paths, fresh, drops;
+	IndexHeader hdr;
+	char pendingKeys[DAV_SEARCH_PENDING][DAV_INDEX_KEY];
+	char path[DAV_PATH_MAX];
+
+	if(!paths.open(sd->vwd(), DAV_PATHS_FILE, O_RDWR))
+		return false;
+	sd->remove(DAV_FRESH_TMP);
+	sd->remove(DAV_DROP_TMP);
+	sd->remove(DAV_INDEX_TMP);
+	if(!oldIdx.open(sd->vwd(), DAV_INDEX_FILE, O_READ) || oldIdx.read(&hdr, sizeof(hdr)) != sizeof(hdr) ||
+			!fresh.open(sd->vwd(), DAV_FRESH_TMP, O_RDWR | O_CREAT | O_TRUNC) ||
+			!drops.open(sd->vwd(), DAV_DROP_TMP, O_RDWR | O_CREAT | O_TRUNC) ||
+			!idx.open(sd->vwd(), DAV_INDEX_TMP, O_RDWR | O_CREAT | O_TRUNC))	{
+		oldIdx.close();
+		paths.close();
+		fresh.close();
+		drops.close();
+		return false;
+	}
+
+	// records below pending directories, found before fresh paths are appended
+	uint32_t numDrops = findDrops(&paths, &drops);
+	sortRecords(&drops, numDrops);
+
+	// records for the pending paths that still exist, and for what is below
+	// pending directories, sorted on the card like a rebuild
+	uint32_t numFresh = 0;
+	uint32_t oldCount = hdr.count;
+	uint32_t deadSize = hdr.deadSize;
+	memset(&hdr, 0, sizeof(hdr));
+	fresh.write(&hdr, sizeof(hdr));
+	paths.seekEnd();
+	for(uint8_t i = 0; i < numPending; i++)	{
+		makeKey(baseName(pending[i].c_str()), pendingKeys[i]);
+
+		FatFile tFile;
+		IndexRecord rec;
+		if(!tFile.open(sd->vwd(), pending[i].c_str(), O_READ))
+			continue;
+		if(makeRecord(&tFile, pending[i].c_str(), &paths, &rec) && fresh.write(&rec, sizeof(rec)) == sizeof(rec))
+			numFresh++;
+		bool isDir = tFile.isDir();
+		tFile.close();
+
+		if(pendingTree[i] && isDir)
+			walkTree(pending[i].c_str(), &fresh, &paths, &numFresh);
+	}
+	sortRecords(&fresh, numFresh);
+
+	uint32_t count = 0;
+	uint32_t freshIdx = 0;
+	uint32_t dropIdx = 0;
+	IndexRecord freshRec;
+	bool haveFresh = numFresh && readRecord(&fresh, 0, &freshRec);
+	idx.write(&hdr, sizeof(hdr));
+
+	for(uint32_t n = 0; n < oldCount; n++)	{
+		IndexRecord rec;
+		if(oldIdx.read(&rec, sizeof(rec)) != sizeof(rec))
+			break;
+
+		// only records sharing a key with a pending path need their path read
+		bool isPending = false;
+		for(uint8_t k = 0; k < numPending && !isPending; k++)
+			if(memcmp(rec.key, pendingKeys[k], DAV_INDEX_KEY) == 0 && readPath(&paths, &rec, path))
+				isPending = pending[k].equalsIgnoreCase(path);
+
+		uint32_t pathSize;
+		if(isPending)	{
+			deadSize += strlen(path) + 1;
+			continue;
+		}
+		if(numDrops && isDropped(&drops, numDrops, &dropIdx, &rec, &pathSize))	{
+			deadSize += pathSize;
+			continue;
+		}
+
+		while(haveFresh && memcmp(freshRec.key, rec.key, DAV_INDEX_KEY) < 0)	{
+			idx.write(&freshRec, sizeof(freshRec));
+			count++;
+			haveFresh = ++freshIdx < numFresh && readRecord(&fresh, freshIdx, &freshRec);
+		}
+		idx.write(&rec, sizeof(rec));
+		count++;
+	}
+
+	while(haveFresh)	{
+		idx.write(&freshRec, sizeof(freshRec));
+		count++;
+		haveFresh = ++freshIdx < numFresh && readRecord(&fresh, freshIdx, &freshRec);
+	}
+
+	oldIdx.close();
+	fresh.close();
+	drops.close();
+	sd->remove(DAV_FRESH_TMP);
+	sd->remove(DAV_DROP_TMP);
+
+	// mostly dead paths, copy the live ones to a fresh file
+	if(paths.fileSize() > DAV_PATHS_COMPACT && deadSize > paths.fileSize() / 2)	{
+		FatFile newPaths;
+		bool compacted = compactPaths(&idx, count, &paths, &newPaths);
+		paths.close();
+		if(!compacted)	{
+			idx.close();
+			return false;
+		}
+		return finish(&idx, &newPaths, count, DAV_PATHS_TMP, 0);
+	}
+	return finish(&idx, &paths, count, DAV_PATHS_FILE, deadSize);
+}
+
+
+
+// ------------------------
+uint32_t SearchIndex::findDrops(FatFile *paths, FatFile *drops)	{
+// ------------------------
+	// one pass over the paths file, a drop record for every path below a pending
+	// directory, keyed like the record pointing to it
+	uint32_t numDrops = 0;
+	IndexHeader hdr;
+	memset(&hdr, 0, sizeof(hdr));
+	drops->write(&hdr, sizeof(hdr));
+
+	bool haveTree = false;
+	for(uint8_t i = 0; i < numPending; i++)
+		haveTree |= pendingTree[i];
+	if(!haveTree)
+		return 0;
+
+	char path[DAV_PATH_MAX];
+	uint32_t size = paths->fileSize();
+	for(uint32_t offset = 0; offset < size; )	{
+		IndexRecord rec;
+		rec.pathOffset = offset;
+		if(!readPath(paths, &rec, path))
+			break;
+		size_t len = strlen(path);
+		offset += len + 1;
+
+		for(uint8_t i = 0; i < numPending; i++)	{
+			if(!isUnderTree(path, i))
+				continue;
+			makeKey(baseName(path), rec.key);
+			rec.size = len + 1;
+			rec.mtime = 0;
+			if(drops->write(&rec, sizeof(rec)) == sizeof(rec))
+				numDrops++;
+			break;
+		}
+		yield();
+	}
+	return numDrops;
+}
+
+
+
+// ------------------------
+bool SearchIndex::isDropped(FatFile *drops, uint32_t numDrops, uint32_t *dropIdx, const IndexRecord *rec, uint32_t *pathSize)	{
+// ------------------------
+	// drops are sorted like the records, those with a lower key are passed for good
+	IndexRecord drop;
+	while(*dropIdx < numDrops && readRecord(drops, *dropIdx, &drop) && memcmp(drop.key, rec->key, DAV_INDEX_KEY) < 0)
+		(*dropIdx)++;
+
+	for(uint32_t i = *dropIdx; i < numDrops && readRecord(drops, i, &drop) && memcmp(drop.key, rec->key, DAV_INDEX_KEY) == 0; i++)
+		if(drop.pathOffset == (rec->pathOffset & ~DAV_INDEX_DIR))	{
+			*pathSize = drop.size;
+			return true;
+		}
+	return false;
+}
+
+
+
+// ------------------------
+bool SearchIndex::compactPaths(FatFile *idx, uint32_t count, FatFile *paths, FatFile *newPaths)	{
+// ------------------------
+	// copy the path of every record and point the record at the copy
+	char path[DAV_PATH_MAX];
+	sd->remove(DAV_PATHS_TMP);
+	if(!newPaths->open(sd->vwd(), DAV_PATHS_TMP, O_RDWR | O_CREAT | O_TRUNC))
+		return false;
+
+	for(uint32_t n = 0; n < count; n++)	{
+		IndexRecord rec;
+		if(!readRecord(idx, n, &rec) || !readPath(paths, &rec, path))	{
+			newPaths->close();
+			return false;
+		}
+		size_t len = strlen(path) + 1;
+		rec.pathOffset = newPaths->fileSize() | (rec.pathOffset & DAV_INDEX_DIR);
+		if(newPaths->write(path, len) != (int) len || !writeRecord(idx, n, &rec))	{
+			newPaths->close();
+			return false;
+		}
+		yield();
+	}
+	return true;
+}
+
+
+
+// ------------------------
+bool SearchIndex::finish(FatFile *idx, FatFile *paths, uint32_t count, const char *pathsName, uint32_t deadSize)	{
+// ------------------------
+	// seal the new index and move it in place of the old one
+	IndexHeader hdr;
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+	hdr.count = count;
+	hdr.pathsSize = paths->fileSize();
+	hdr.clean = 1;
+	hdr.deadSize = deadSize;
+
+	bool retVal = idx->seekSet(0) && (idx->write(&hdr, sizeof(hdr)) == sizeof(hdr)) && idx->sync() && paths->sync();
+	idx->close();
+	paths->close();
+	if(!retVal)
+		return false;
+
+	// a crash between the renames leaves sizes that fail validation
+	sd->remove(DAV_INDEX_FILE);
+	if(!sd->rename(DAV_INDEX_TMP, DAV_INDEX_FILE))
+		return false;
+
+	if(strcmp(pathsName, DAV_PATHS_FILE) != 0)	{
+		sd->remove(DAV_PATHS_FILE);
+		if(!sd->rename(pathsName, DAV_PATHS_FILE))
+			return false;
+	}
+	return true;
+}
+
+
+
+// ------------------------
+void SearchIndex::sortRecords(FatFile *idx, uint32_t count)	{
+// ------------------------
+	// heap sort in place on the card, constant RAM for any number of files
+	if(count < 2)
+		return;
+
+	for(uint32_t start = count / 2; start-- > 0; )
+		siftDown(idx, start, count);
+
+	for(uint32_t end = count - 1; end > 0; end--)	{
+		IndexRecord first, last;
+		readRecord(idx, 0, &first);
+		readRecord(idx, end, &last);
+		writeRecord(idx, 0, &last);
+		writeRecord(idx, end, &first);
+		siftDown(idx, 0, end);
+		yield();
+	}
+}
+
+
+
+// ------------------------
+void SearchIndex::siftDown(FatFile *idx, uint32_t root, uint32_t count)	{
+// ------------------------
+	IndexRecord top, child, other;
+	readRecord(idx, root, &top);
+
+	while(true)	{
+		uint32_t childIdx = 2 * root + 1;
+		if(childIdx >= count)
+			break;
+
+		readRecord(idx, childIdx, &child);
+		if(childIdx + 1 < count)	{
+			readRecord(idx, childIdx + 1, &other);
+			if(memcmp(other.key, child.key, DAV_INDEX_KEY) > 0)	{
+				childIdx++;
+				child = other;
+			}
+		}
+
+		if(memcmp(top.key, child.key, DAV_INDEX_KEY) >= 0)
+			break;
+		writeRecord(idx, root, &child);
+		root = childIdx;
+	}
+	writeRecord(idx, root, &top);
+}
+
+
+
+// ------------------------
+bool SearchIndex::readRecord(FatFile *idx, uint32_t n, IndexRecord *rec)	{
+// ------------------------
+	return idx->seekSet(sizeof(IndexHeader) + n * sizeof(IndexRecord)) &&
+		(idx->read(rec, sizeof(IndexRecord)) == sizeof(IndexRecord));
+}
+
+
+
+// ------------------------
+bool SearchIndex::writeRecord(FatFile *idx, uint32_t n, const IndexRecord *rec)	{
+// ------------------------
+	return idx->seekSet(sizeof(IndexHeader) + n * sizeof(IndexRecord)) &&
+		(idx->write(rec, sizeof(IndexRecord)) == sizeof(IndexRecord));
+}
+
+
+
+// ------------------------
+bool SearchIndex::readPath(FatFile *paths, const IndexRecord *rec, char *buf)	{
+// ------------------------
+	// buf holds DAV_PATH_MAX, the path ends at the first zero
+	if(!paths->seekSet(rec->pathOffset & ~DAV_INDEX_DIR))
+		return false;
+	int numRead = paths->read(buf, DAV_PATH_MAX - 1);
+	if(numRead <= 0)
+		return false;
+	buf[numRead] = 0;
+	return true;
+}
+
+
+
+// ------------------------
+bool SearchIndex::search(const SearchQuery &query, SearchHit hit, void *ctx)	{
+// ------------------------
+	if(needsRebuild)
+		return false;
+
+	FatFile idx, paths;
+	IndexHeader hdr;
+	if(!idx.open(sd->vwd(), DAV_INDEX_FILE, O_READ))
+		return false;
+	if(!paths.open(sd->vwd(), DAV_PATHS_FILE, O_READ) || idx.read(&hdr, sizeof(hdr)) != sizeof(hdr))	{
+		idx.close();
+		return false;
+	}
+
+	// name condition, keys are lower case
+	bool isLike = (query.nameEq.length() == 0);
+	String pattern = isLike ? query.nameLike : query.nameEq;
+	pattern.toLowerCase();
+
+	// the literal start of the name narrows the scan to a range of keys
+	char prefix[DAV_INDEX_KEY];
+	size_t prefixLen = 0;
+	while(prefixLen < DAV_INDEX_KEY - 1 && prefixLen < pattern.length())	{
+		char c = pattern[prefixLen];
+		if(isLike && (c == '%' || c == '_'))
+			break;
+		prefix[prefixLen++] = c;
+	}
+
+	IndexRecord rec;
+	uint32_t lo = 0, hi = hdr.count;
+	while(prefixLen && lo < hi)	{
+		uint32_t mid = (lo + hi) / 2;
+		if(!readRecord(&idx, mid, &rec))
+			break;
+		if(memcmp(rec.key, prefix, prefixLen) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	char path[DAV_PATH_MAX];
+	uint32_t numHits = 0;
+	for(uint32_t n = lo; n < hdr.count; n++)	{
+		if(!readRecord(&idx, n, &rec))
+			break;
+		if(prefixLen && memcmp(rec.key, prefix, prefixLen) != 0)
+			break;
+
+		if(query.filesOnly && (rec.pathOffset & DAV_INDEX_DIR))
+			continue;
+		if(rec.size < query.minSize || rec.size > query.maxSize || rec.mtime < query.minTime || rec.mtime > query.maxTime)
+			continue;
+
+		// short names are whole in the key, longer ones need the path
+		bool havePath = false;
+		if(pattern.length())	{
+			const char *name = rec.key;
+			if(strlen(rec.key) == DAV_INDEX_KEY - 1)	{
+				if(!readPath(&paths, &rec, path))
+					continue;
+				havePath = true;
+				name = baseName(path);
+			}
+			if(isLike ? !likeMatch(pattern.c_str(), name) : (strcasecmp(pattern.c_str(), name) != 0))
+				continue;
+		}
+
+		if(!havePath && !readPath(&paths, &rec, path))
+			continue;
+
+		// scope is a directory, match whole path segments
+		size_t scopeLen = query.scope.length();
+		if(scopeLen && !(query.scope.equals("/") || (strncasecmp(path, query.scope.c_str(), scopeLen) == 0 &&
+				(path[scopeLen] == '/' || path[scopeLen] == 0 || query.scope.endsWith("/")))))
+			continue;
+
+		if(!hit(ctx, path, &rec))
+			break;
+		if(query.limit && ++numHits >= query.limit)
+			break;
+	}
+
+	idx.close();
+	paths.close();
+	return true;
+}
+
+
+
+// ------------------------
+uint32_t SearchIndex::fatToEpoch(uint16_t date, uint16_t time)	{
+// ------------------------
+	return civilToEpoch(FAT_YEAR(date), FAT_MONTH(date), FAT_DAY(date), FAT_HOUR(time), FAT_MINUTE(time), FAT_SECOND(time));
+}
+
+
+
+// ------------------------
+uint32_t SearchIndex::civilToEpoch(int year, int month, int day, int hour, int minute, int second)	{
+// ------------------------
+	// days since 1970-01-01 in the proleptic Gregorian calendar, no mktime needed
+	year -= (month <= 2);
+	int era = (year >= 0 ? year : year - 399) / 400;
+	unsigned yoe = (unsigned) (year - era * 400);
+	unsigned doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+	unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+	int32_t days = era * 146097 + (int32_t) doe - 719468;
+	return (uint32_t) days * 86400 + hour * 3600 + minute * 60 + second;
+}
+
+
+
+// ------------------------
+bool SearchIndex::likeMatch(const char *pattern, const char *str)	{
+// ------------------------
+	// SQL style: % any run, _ any one character, case insensitive
+	const char *starPattern = NULL;
+	const char *starStr = NULL;
+
+	while(*str)	{
+		if(*pattern == '%')	{
+			starPattern = ++pattern;
+			starStr = str;
+		}
+		else if(*pattern && (*pattern == '_' || tolower(*pattern) == tolower(*str)))	{
+			pattern++;
+			str++;
+		}
+		else if(starPattern)	{
+			pattern = starPattern;
+			str = ++starStr;
+		}
+		else
+			return false;
+	}
+
+	while(*pattern == '%')
+		pattern++;
+	return *pattern == 0;
+}
+
+
+
+// ------------------------
+void SearchIndex::makeKey(const char *name, char *key)	{
+// ------------------------
+	memset(key, 0, DAV_INDEX_KEY);
+	for(size_t i = 0; i < DAV_INDEX_KEY - 1 && name[i]; i++)
+		key[i] = tolower(name[i]);
+}
+
+
+
+// ------------------------
+const char *SearchIndex::baseName(const char *path)	{
+// ------------------------
+	const char *slash = strrchr(path, '/');
+	return slash ? slash + 1 : path;
+}
+
+
+
+// ------------------------
+bool SearchIndex::isIndexFile(const char *name)	{
+// ------------------------
+	// the index files in the root, names taken from their paths
+	static const char *names[] = { DAV_INDEX_FILE, DAV_INDEX_TMP, DAV_PATHS_FILE, DAV_PATHS_TMP, DAV_FRESH_TMP, DAV_DROP_TMP };
+	for(size_t i = 0; i < sizeof(names)/sizeof(names[0]); i++)
+		if(strcmp(name, names[i] + 1) == 0)
+			return true;
+	return false;
+}
+
+
+
+// ------------------------
+bool SearchIndex::isHiddenFile(const char *name)	{
+// ------------------------
+	// index files and uploads not complete yet stay out of listings and the index
+	return isIndexFile(name) || isUploadFile(name);
+}
+
+
+
+// ------------------------
+bool SearchIndex::isUploadFile(const char *name)	{
+// ------------------------
+	size_t len = strlen(name);
+	size_t suffixLen = strlen(DAV_UPLOAD_SUFFIX);
+	return len > suffixLen && strcmp(name + len - suffixLen, DAV_UPLOAD_SUFFIX) == 0;
+}
+
+
+
+// ------------------------
+void TreeWalk::begin(SdFat *sdFat, const char *top)	{
+// ------------------------
+	sd = sdFat;
+	strncpy(pathBuf, top, DAV_PATH_MAX - 1);
+	pathBuf[DAV_PATH_MAX - 1] = 0;
+	pathLen = strlen(pathBuf);
+	depth = 0;
+	positions[0] = 0;
+	enterChild = false;
+	openDir();
+}
+
+
+
+// ------------------------
+bool TreeWalk::next(FatFile *child)	{
+// ------------------------
+	// a directory returned last time is entered now
+	if(enterChild)	{
+		positions[depth++] = dir.curPosition();
+		positions[depth] = 0;
+		pathLen = strlen(pathBuf);
+		dir.close();
+		openDir();
+		enterChild = false;
+	}
+
+	while(true)	{
+		pathBuf[pathLen] = 0;
+		if(!child->openNext(&dir, O_READ))	{
+			dir.close();
+			if(depth == 0)
+				return false;
+
+			// back up to the parent, where it left off
+			depth--;
+			pathLen = strrchr(pathBuf, '/') - pathBuf;
+			pathBuf[pathLen] = 0;
+			openDir();
+			continue;
+		}
+
+		// names that do not fit the path are passed over
+		pathBuf[pathLen] = '/';
+		if(child->getName(pathBuf + pathLen + 1, DAV_PATH_MAX - pathLen - 1))
+			break;
+		child->close();
+	}
+
+	enterChild = child->isDir() && depth + 1 < DAV_INDEX_DEPTH;
+	return true;
+}
+
+
+
+// ------------------------
+void TreeWalk::openDir()	{
+// ------------------------
+	// a directory that fails to open is left closed and reads as empty
+	bool dirOk = pathLen ? dir.open(sd->vwd(), pathBuf, O_READ) : dir.openRoot(sd->vol());
+	if(dirOk && !dir.seekSet(positions[depth]))
+		dir.close();
+}
@@ -0,0 +1,164 @@
+#ifndef SEARCH_INDEX_H
+#define SEARCH_INDEX_H
+
+// Filename index kept on the card.
+//   /.davindex  header followed by fixed size records sorted by name key
+//   /.davpaths  full paths the records point into, appended to and
+//               compacted once half of it is no longer pointed to
+// Changes are collected in RAM and merged into the sorted records in one
+// sequential pass. A changed directory (moved, unpacked) stands for its
+// subtree: its old records are found in one pass over the paths file, its
+// new ones by walking it, and both lists are sorted on the card, so a
+// subtree of any size merges without a rebuild.
+// A crash with unmerged changes leaves the header marked dirty and the
+// index is rebuilt from a tree walk.
+
+#include <SdFat.h>
+#include "ESPWebDAVConfig.h"
+
+#define DAV_INDEX_FILE		"/.davindex"
+#define DAV_INDEX_TMP		"/.davindex.tmp"
+#define DAV_PATHS_FILE		"/.davpaths"
+#define DAV_PATHS_TMP		"/.davpaths.tmp"
+#define DAV_FRESH_TMP		"/.davfresh.tmp"
+#define DAV_DROP_TMP		"/.davdrop.tmp"
+
+#define DAV_INDEX_KEY		20
+#define DAV_PATH_MAX		256
+#define DAV_INDEX_DIR		0x80000000UL
+// directories nested deeper are left out of the index
+#define DAV_INDEX_DEPTH		16
+// paths file size below which it is never compacted
+#define DAV_PATHS_COMPACT	4096
+
+
+struct IndexHeader	{
+	char magic[8];
+	uint32_t count;
+	uint32_t pathsSize;
+	uint32_t clean;
+	uint32_t deadSize;		// bytes of paths no record points to
+	uint8_t reserved[8];
+};
+
+struct IndexRecord	{
+	char key[DAV_INDEX_KEY];	// lower case start of the name, zero padded
+	uint32_t size;
+	uint32_t mtime;			// seconds since 1970
+	uint32_t pathOffset;	// into the paths file, DAV_INDEX_DIR for directories
+};
+
+// all conditions must hold, empty strings and zero limits are ignored
+struct SearchQuery	{
+	String nameEq;
+	String nameLike;		// % and _ wildcards
+	String scope;			// path prefix
+	uint32_t minSize;
+	uint32_t maxSize;
+	uint32_t minTime;
+	uint32_t maxTime;
+	uint32_t limit;
+	bool filesOnly;
+
+	SearchQuery() : minSize(0), maxSize(0xFFFFFFFF), minTime(0), maxTime(0xFFFFFFFF), limit(0), filesOnly(false)	{}
+};
+
+// Depth first walk of a directory tree without recursion. Each level keeps
+// only its position, a directory is opened again by path when the walk comes
+// back up to it. Directories deeper than DAV_INDEX_DEPTH are not entered.
+class TreeWalk	{
+public:
+	// top is a directory path, empty for the root
+	void begin(SdFat *sd, const char *top);
+	// next entry below top, opened in child, false once the walk is done
+	bool next(FatFile *child);
+	const char *path()	{ return pathBuf; }
+
+protected:
+	void openDir();
+
+	SdFat *sd;
+	char pathBuf[DAV_PATH_MAX];
+	uint32_t positions[DAV_INDEX_DEPTH];
+	size_t pathLen;
+	uint8_t depth;
+	bool enterChild;
+	FatFile dir;
+};
+
+// rebuild in progress, kept between steps
+enum BuildPhase { BUILD_WALK, BUILD_HEAP, BUILD_SORT };
+
+struct IndexBuild	{
+	TreeWalk walk;
+	FatFile idx;
+	FatFile paths;
+	uint32_t count;
+	uint32_t sortPos;		// next record to sift down
+	BuildPhase phase;
+	long tStart;
+};
+
+// return false to stop the search
+typedef bool (*SearchHit)(void *ctx, const char *path, const IndexRecord *rec);
+
+
+class SearchIndex	{
+public:
+	SearchIndex();
+	void begin(SdFat *sd);
+	void touch(const char *path);
+	void touchTree(const char *path);
+	void invalidate();
+	bool isPending()	{ return (numPending || needsRebuild) && !failed; }
+	bool isFull()	{ return numPending == DAV_SEARCH_PENDING; }
+	bool covers(const char *path);
+	bool isReady()	{ return !needsRebuild; }
+	bool flush();
+	// a rebuild goes one walked entry or sifted record per step, changes
+	// made meanwhile are merged after it. true while there is more to do
+	bool flushStep();
+	bool isBuilding()	{ return build != NULL; }
+	bool search(const SearchQuery &query, SearchHit hit, void *ctx);
+
+	static uint32_t fatToEpoch(uint16_t date, uint16_t time);
+	static uint32_t civilToEpoch(int year, int month, int day, int hour, int minute, int second);
+	static bool likeMatch(const char *pattern, const char *str);
+	static bool isIndexFile(const char *name);
+	static bool isHiddenFile(const char *name);
+	static bool isUploadFile(const char *name);
+	static void makeKey(const char *name, char *key);
+
+protected:
+	bool beginBuild();
+	bool stepBuild();
+	bool finishBuild();
+	void cancelBuild();
+	bool merge();
+	bool validate();
+	void markDirty();
+	void walkTree(const char *top, FatFile *idx, FatFile *paths, uint32_t *count);
+	void addEntry(FatFile *child, const char *path, FatFile *idx, FatFile *paths, uint32_t *count);
+	bool makeRecord(FatFile *file, const char *path, FatFile *paths, IndexRecord *rec);
+	uint32_t findDrops(FatFile *paths, FatFile *drops);
+	bool isDropped(FatFile *drops, uint32_t numDrops, uint32_t *dropIdx, const IndexRecord *rec, uint32_t *pathSize);
+	bool compactPaths(FatFile *idx, uint32_t count, FatFile *paths, FatFile *newPaths);
+	bool isUnderTree(const char *path, uint8_t i);
+	void sortRecords(FatFile *idx, uint32_t count);
+	void siftDown(FatFile *idx, uint32_t root, uint32_t count);
+	bool readRecord(FatFile *idx, uint32_t n, IndexRecord *rec);
+	bool writeRecord(FatFile *idx, uint32_t n, const IndexRecord *rec);
+	bool readPath(FatFile *paths, const IndexRecord *rec, char *buf);
+	bool finish(FatFile *idx, FatFile *paths, uint32_t count, const char *pathsName, uint32_t deadSize);
+	static const char *baseName(const char *path);
+
+	SdFat *sd;
+	IndexBuild *build;
+	String pending[DAV_SEARCH_PENDING];
+	bool pendingTree[DAV_SEARCH_PENDING];		// stands for everything below it too
+	uint8_t numPending;
+	bool needsRebuild;
+	bool failed;
+};
+
+#endif
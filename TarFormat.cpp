@@ -0,0 +1,205 @@
+#include <string.h>
+#include "TarFormat.h"
+
+
+// ------------------------
+bool TarFormat::isEnd(const TarHeader *h)	{
+// ------------------------
+	// archives end with zero blocks
+	return h->name[0] == 0;
+}
+
+
+
+// ------------------------
+bool TarFormat::checksumOk(const TarHeader *h)	{
+// ------------------------
+	// byte sum of the header with the checksum field read as spaces
+	const uint8_t *bytes = (const uint8_t *) h;
+	uint32_t sum = 0;
+	for(size_t i = 0; i < sizeof(TarHeader); i++)
+		sum += bytes[i];
+	for(size_t i = 0; i < sizeof(h->chksum); i++)
+		sum += ' ' - (uint8_t) h->chksum[i];
+
+	return sum == octal(h->chksum, sizeof(h->chksum));
+}
+
+
+
+// ------------------------
+uint32_t TarFormat::size(const TarHeader *h)	{
+// ------------------------
+	// base-256 sizes are for members FAT cannot hold anyway
+	if(h->size[0] & 0x80)
+		return 0xFFFFFFFF;
+	return octal(h->size, sizeof(h->size));
+}
+
+
+
+// ------------------------
+bool TarFormat::isFile(const TarHeader *h)	{
+// ------------------------
+	return h->typeflag == TAR_TYPE_FILE || h->typeflag == TAR_TYPE_OLDFILE || h->typeflag == TAR_TYPE_CONTIG;
+}
+
+
+
+// ------------------------
+bool TarFormat::fullName(const TarHeader *h, char *buf, size_t bufSize)	{
+// ------------------------
+	// prefix/name, neither field has to be terminated
+	// false if it does not fit, buf then holds as much of it as does
+	size_t prefixLen = strnlen(h->prefix, sizeof(h->prefix));
+	size_t nameLen = strnlen(h->name, sizeof(h->name));
+	size_t len = 0;
+	bool retVal = (prefixLen ? prefixLen + 1 : 0) + nameLen < bufSize;
+
+	if(prefixLen)	{
+		len = (prefixLen < bufSize - 1) ? prefixLen : bufSize - 1;
+		memcpy(buf, h->prefix, len);
+		if(len < bufSize - 1)
+			buf[len++] = '/';
+	}
+	if(len + nameLen >= bufSize)
+		nameLen = bufSize - len - 1;
+	memcpy(buf + len, h->name, nameLen);
+	buf[len + nameLen] = 0;
+	return retVal;
+}
+
+
+
+// ------------------------
+bool TarFormat::paxPath(const char *data, size_t len, char *buf, size_t bufSize, bool *tooLong)	{
+// ------------------------
+	// records are "length key=value\n", pick the path one
+	// tooLong is set when the path does not fit or may be in a record cut off
+	size_t idx = 0;
+	while(idx < len)	{
+		uint32_t recLen = 0;
+		size_t pos = idx;
+		while(pos < len && data[pos] >= '0' && data[pos] <= '9')
+			recLen = recLen * 10 + (data[pos++] - '0');
+		if(recLen && idx + recLen > len)
+			*tooLong = true;
+		if(recLen == 0 || idx + recLen > len || pos >= len || data[pos] != ' ')
+			return false;
+
+		const char *key = data + pos + 1;
+		const char *recEnd = data + idx + recLen - 1;
+		if(recEnd - key > 5 && !strncmp(key, "path=", 5))	{
+			size_t valueLen = recEnd - (key + 5);
+			*tooLong = (valueLen >= bufSize);
+			if(*tooLong)
+				return false;
+			memcpy(buf, key + 5, valueLen);
+			buf[valueLen] = 0;
+			return true;
+		}
+		idx += recLen;
+	}
+	return false;
+}
+
+
+
+// ------------------------
+uint32_t TarFormat::padding(uint32_t size)	{
+// ------------------------
+	return (TAR_BLOCK - (size % TAR_BLOCK)) % TAR_BLOCK;
+}
+
+
+
+// ------------------------
+uint32_t TarFormat::octal(const char *field, size_t len)	{
+// ------------------------
+	// leading spaces, digits, then space or NUL
+	uint32_t value = 0;
+	size_t idx = 0;
+	while(idx < len && field[idx] == ' ')
+		idx++;
+	while(idx < len && field[idx] >= '0' && field[idx] <= '7')
+		value = (value << 3) | (field[idx++] - '0');
+	return value;
+}
+
+
+
+// ------------------------
+bool TarFormat::makeHeader(TarHeader *h, const char *name, uint32_t size, uint32_t mtime, char type)	{
+// ------------------------
+	// false when the name had to be cut, a long name member must come first
+	memset(h, 0, sizeof(TarHeader));
+	size_t len = strlen(name);
+	bool fits = true;
+
+	if(len <= sizeof(h->name))
+		memcpy(h->name, name, len);
+	else	{
+		// split at a slash into prefix and name
+		int splitIdx = -1;
+		for(size_t i = len - 1; i > 0 && len - i - 1 <= sizeof(h->name); i--)
+			if(name[i] == '/' && i <= sizeof(h->prefix))
+				splitIdx = i;
+
+		if(splitIdx > 0 && len - splitIdx - 1 > 0)	{
+			memcpy(h->prefix, name, splitIdx);
+			memcpy(h->name, name + splitIdx + 1, len - splitIdx - 1);
+		}
+		else	{
+			memcpy(h->name, name, sizeof(h->name));
+			fits = false;
+		}
+	}
+
+	putOctal(h->mode, sizeof(h->mode), (type == TAR_TYPE_DIR) ? 0755 : 0644);
+	putOctal(h->uid, sizeof(h->uid), 0);
+	putOctal(h->gid, sizeof(h->gid), 0);
+	putOctal(h->size, sizeof(h->size), size);
+	putOctal(h->mtime, sizeof(h->mtime), mtime);
+	h->typeflag = type;
+	memcpy(h->magic, "ustar", 6);
+	memcpy(h->version, "00", 2);
+	setChecksum(h);
+	return fits;
+}
+
+
+
+// ------------------------
+void TarFormat::makeLongName(TarHeader *h, uint32_t nameLen)	{
+// ------------------------
+	// the name follows as member data, NUL terminated
+	makeHeader(h, TAR_LONGLINK, nameLen + 1, 0, TAR_TYPE_LONGNAME);
+}
+
+
+
+// ------------------------
+void TarFormat::putOctal(char *field, size_t len, uint32_t value)	{
+// ------------------------
+	// zero padded digits and a NUL
+	field[len - 1] = 0;
+	for(int i = len - 2; i >= 0; i--)	{
+		field[i] = '0' + (value & 7);
+		value >>= 3;
+	}
+}
+
+
+
+// ------------------------
+void TarFormat::setChecksum(TarHeader *h)	{
+// ------------------------
+	memset(h->chksum, ' ', sizeof(h->chksum));
+	const uint8_t *bytes = (const uint8_t *) h;
+	uint32_t sum = 0;
+	for(size_t i = 0; i < sizeof(TarHeader); i++)
+		sum += bytes[i];
+
+	// six digits, NUL, space
+	putOctal(h->chksum, 7, sum);
+}
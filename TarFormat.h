@@ -0,0 +1,62 @@
+#ifndef TAR_FORMAT_H
+#define TAR_FORMAT_H
+
+// ustar archive headers, POSIX.1-1988 with the GNU long name and pax path
+// extensions. Only the header block is handled here, member data is
+// streamed by the caller in 512 byte blocks.
+// Names that fit neither name nor prefix/name are written as a GNU long
+// name member, which GNU tar, bsdtar and Python all read.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TAR_BLOCK			512
+
+#define TAR_TYPE_FILE		'0'
+#define TAR_TYPE_OLDFILE	'\0'
+#define TAR_TYPE_CONTIG		'7'
+#define TAR_TYPE_DIR		'5'
+#define TAR_TYPE_LONGNAME	'L'
+#define TAR_TYPE_PAX		'x'
+#define TAR_LONGLINK		"././@LongLink"
+
+
+struct TarHeader	{
+	char name[100];
+	char mode[8];
+	char uid[8];
+	char gid[8];
+	char size[12];
+	char mtime[12];
+	char chksum[8];
+	char typeflag;
+	char linkname[100];
+	char magic[6];
+	char version[2];
+	char uname[32];
+	char gname[32];
+	char devmajor[8];
+	char devminor[8];
+	char prefix[155];
+	char pad[12];
+};
+
+
+class TarFormat	{
+public:
+	static bool isEnd(const TarHeader *h);
+	static bool checksumOk(const TarHeader *h);
+	static uint32_t size(const TarHeader *h);
+	static bool isFile(const TarHeader *h);
+	static bool fullName(const TarHeader *h, char *buf, size_t bufSize);
+	static bool paxPath(const char *data, size_t len, char *buf, size_t bufSize, bool *tooLong);
+	static uint32_t padding(uint32_t size);
+	static uint32_t octal(const char *field, size_t len);
+
+	static bool makeHeader(TarHeader *h, const char *name, uint32_t size, uint32_t mtime, char type);
+	static void makeLongName(TarHeader *h, uint32_t nameLen);
+	static void putOctal(char *field, size_t len, uint32_t value);
+	static void setChecksum(TarHeader *h);
+};
+
+#endif
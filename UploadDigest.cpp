@@ -0,0 +1,232 @@
+#include "UploadDigest.h"
+
+#define ROTR(x, n)	(((x) >> (n)) | ((x) << (32 - (n))))
+
+static const uint32_t sha256K[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+// CRC-32C (Castagnoli), reflected, a nibble at a time
+static const uint32_t crc32cTable[16] = {
+	0x00000000, 0x105ec76f, 0x20bd8ede, 0x30e349b1, 0x417b1dbc, 0x5125dad3, 0x61c69362, 0x7198540d,
+	0x82f63b78, 0x92a8fc17, 0xa24bb5a6, 0xb21572c9, 0xc38d26c4, 0xd3d3e1ab, 0xe330a81a, 0xf36e6f75
+};
+
+
+// ------------------------
+void Sha256::begin()	{
+// ------------------------
+	static const uint32_t init[8] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+	memcpy(state, init, sizeof(state));
+	length = 0;
+	blockLen = 0;
+}
+
+
+
+// ------------------------
+void Sha256::update(const uint8_t *data, size_t len)	{
+// ------------------------
+	length += len;
+	while(len)	{
+		size_t numCopy = sizeof(block) - blockLen;
+		if(numCopy > len)
+			numCopy = len;
+		memcpy(block + blockLen, data, numCopy);
+		blockLen += numCopy;
+		data += numCopy;
+		len -= numCopy;
+
+		if(blockLen == sizeof(block))	{
+			transform();
+			blockLen = 0;
+		}
+	}
+}
+
+
+
+// ------------------------
+void Sha256::finish(uint8_t *out)	{
+// ------------------------
+	// 0x80, zeros, then the length in bits big endian
+	uint64_t numBits = length * 8;
+	block[blockLen++] = 0x80;
+	if(blockLen > 56)	{
+		memset(block + blockLen, 0, sizeof(block) - blockLen);
+		transform();
+		blockLen = 0;
+	}
+	memset(block + blockLen, 0, 56 - blockLen);
+	for(int i = 0; i < 8; i++)
+		block[63 - i] = numBits >> (8 * i);
+	transform();
+
+	for(int i = 0; i < 8; i++)
+		for(int j = 0; j < 4; j++)
+			out[4 * i + j] = state[i] >> (24 - 8 * j);
+}
+
+
+
+// ------------------------
+void Sha256::transform()	{
+// ------------------------
+	// message schedule kept as a rolling 16 word window
+	uint32_t w[16];
+	for(int i = 0; i < 16; i++)
+		w[i] = ((uint32_t) block[4 * i] << 24) | ((uint32_t) block[4 * i + 1] << 16) | ((uint32_t) block[4 * i + 2] << 8) | block[4 * i + 3];
+
+	uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+	uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+
+	for(int i = 0; i < 64; i++)	{
+		if(i >= 16)	{
+			uint32_t w15 = w[(i + 1) & 15];
+			uint32_t w2 = w[(i + 14) & 15];
+			uint32_t s0 = ROTR(w15, 7) ^ ROTR(w15, 18) ^ (w15 >> 3);
+			uint32_t s1 = ROTR(w2, 17) ^ ROTR(w2, 19) ^ (w2 >> 10);
+			w[i & 15] += s0 + s1 + w[(i + 9) & 15];
+		}
+
+		uint32_t t1 = h + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25)) + ((e & f) ^ (~e & g)) + sha256K[i] + w[i & 15];
+		uint32_t t2 = (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+		h = g;
+		g = f;
+		f = e;
+		e = d + t1;
+		d = c;
+		c = b;
+		b = a;
+		a = t1 + t2;
+	}
+
+	state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+	state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+}
+
+
+
+
+// ------------------------
+void UploadDigest::begin(DigestType digestType)	{
+// ------------------------
+	type = digestType;
+	if(type == DIGEST_MD5)
+		md5.begin();
+	else if(type == DIGEST_SHA256)
+		sha.begin();
+	crc = 0xFFFFFFFF;
+}
+
+
+
+// ------------------------
+void UploadDigest::update(const uint8_t *data, size_t len)	{
+// ------------------------
+	if(type == DIGEST_MD5)	{
+		// the core takes at most 64K at a time
+		while(len)	{
+			uint16_t numAdd = (len > 0xFFFF) ? 0xFFFF : len;
+			md5.add((uint8_t *) data, numAdd);
+			data += numAdd;
+			len -= numAdd;
+		}
+	}
+	else if(type == DIGEST_SHA256)
+		sha.update(data, len);
+	else if(type == DIGEST_CRC32C)	{
+		for(size_t i = 0; i < len; i++)	{
+			crc ^= data[i];
+			crc = (crc >> 4) ^ crc32cTable[crc & 15];
+			crc = (crc >> 4) ^ crc32cTable[crc & 15];
+		}
+	}
+}
+
+
+
+// ------------------------
+String UploadDigest::finish()	{
+// ------------------------
+	uint8_t out[32];
+	size_t len = 0;
+
+	if(type == DIGEST_MD5)	{
+		md5.calculate();
+		md5.getBytes(out);
+		len = 16;
+	}
+	else if(type == DIGEST_SHA256)	{
+		sha.finish(out);
+		len = 32;
+	}
+	else if(type == DIGEST_CRC32C)	{
+		// big endian, as in the x-goog-hash and digest registries
+		uint32_t value = ~crc;
+		for(int i = 0; i < 4; i++)
+			out[i] = value >> (24 - 8 * i);
+		len = 4;
+	}
+
+	type = DIGEST_NONE;
+	return base64(out, len);
+}
+
+
+
+// ------------------------
+const char *UploadDigest::name(DigestType digestType)	{
+// ------------------------
+	switch(digestType)	{
+		case DIGEST_CRC32C:	return "crc32c";
+		case DIGEST_MD5:	return "md5";
+		case DIGEST_SHA256:	return "sha-256";
+		default:			return "";
+	}
+}
+
+
+
+// ------------------------
+DigestType UploadDigest::parseName(const String& digestName)	{
+// ------------------------
+	if(digestName.equalsIgnoreCase("sha-256"))
+		return DIGEST_SHA256;
+	if(digestName.equalsIgnoreCase("md5"))
+		return DIGEST_MD5;
+	if(digestName.equalsIgnoreCase("crc32c"))
+		return DIGEST_CRC32C;
+	return DIGEST_NONE;
+}
+
+
+
+// ------------------------
+String UploadDigest::base64(const uint8_t *data, size_t len)	{
+// ------------------------
+	static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	String encoded;
+	encoded.reserve((len + 2) / 3 * 4);
+
+	for(size_t i = 0; i < len; i += 3)	{
+		uint32_t group = (uint32_t) data[i] << 16;
+		if(i + 1 < len)
+			group |= (uint32_t) data[i + 1] << 8;
+		if(i + 2 < len)
+			group |= data[i + 2];
+
+		encoded += alphabet[(group >> 18) & 63];
+		encoded += alphabet[(group >> 12) & 63];
+		encoded += (i + 1 < len) ? alphabet[(group >> 6) & 63] : '=';
+		encoded += (i + 2 < len) ? alphabet[group & 63] : '=';
+	}
+	return encoded;
+}
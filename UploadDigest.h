@@ -0,0 +1,51 @@
+#ifndef UPLOAD_DIGEST_H
+#define UPLOAD_DIGEST_H
+
+// Running digest over an upload, fed block by block as the data streams
+// to the card. MD5 comes from the core, SHA-256 and CRC32C are done here.
+// Results are base64 as used by Content-MD5, Digest and Repr-Digest.
+
+#include <Arduino.h>
+#include <MD5Builder.h>
+
+// in order of strength, the strongest one offered is used
+enum DigestType { DIGEST_NONE, DIGEST_CRC32C, DIGEST_MD5, DIGEST_SHA256 };
+
+
+class Sha256	{
+public:
+	void begin();
+	void update(const uint8_t *data, size_t len);
+	void finish(uint8_t *out);
+
+private:
+	void transform();
+
+	uint32_t state[8];
+	uint64_t length;
+	uint8_t block[64];
+	size_t blockLen;
+};
+
+
+class UploadDigest	{
+public:
+	UploadDigest() : type(DIGEST_NONE)	{}
+	void begin(DigestType digestType);
+	void update(const uint8_t *data, size_t len);
+	String finish();
+	bool isActive()	{ return type != DIGEST_NONE; }
+	DigestType getType()	{ return type; }
+
+	static const char *name(DigestType digestType);
+	static DigestType parseName(const String& digestName);
+	static String base64(const uint8_t *data, size_t len);
+
+private:
+	DigestType type;
+	MD5Builder md5;
+	Sha256 sha;
+	uint32_t crc;
+};
+
+#endif
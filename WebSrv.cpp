@@ -1,4 +1,7 @@
 #include "ESPWebDAV.h"
+#if defined(ESP32)
+	#include <lwip/sockets.h>
+#endif
 
 // Sections are copied from ESP8266Webserver
 
@@ -64,6 +67,51 @@ String ESPWebDAV::urlDecode(const String& text)	{
 
 
 
+// ------------------------
+String ESPWebDAV::urlEncode(const String& text)	{
+// ------------------------
+	// path for an href, slashes stay
+	static const char hexDigits[] = "0123456789ABCDEF";
+	String encoded;
+	encoded.reserve(text.length());
+	for(unsigned int i = 0; i < text.length(); i++)	{
+		uint8_t c = text.charAt(i);
+		if(isalnum(c) || c == '/' || c == '-' || c == '_' || c == '.' || c == '~')
+			encoded += (char) c;
+		else	{
+			encoded += '%';
+			encoded += hexDigits[c >> 4];
+			encoded += hexDigits[c & 15];
+		}
+	}
+	return encoded;
+}
+
+
+
+// ------------------------
+String ESPWebDAV::htmlEscape(const String& text)	{
+// ------------------------
+	String escaped;
+	escaped.reserve(text.length());
+	for(unsigned int i = 0; i < text.length(); i++)	{
+		char c = text.charAt(i);
+		if(c == '&')
+			escaped += F("&amp;");
+		else if(c == '<')
+			escaped += F("&lt;");
+		else if(c == '>')
+			escaped += F("&gt;");
+		else if(c == '"')
+			escaped += F("&quot;");
+		else
+			escaped += c;
+	}
+	return escaped;
+}
+
+
+
 // ------------------------
 String ESPWebDAV::urlToUri(String url)	{
 // ------------------------
@@ -77,6 +125,22 @@ String ESPWebDAV::urlToUri(String url)	{
 
 
 
+// ------------------------
+String ESPWebDAV::formatUint64(uint64_t value)	{
+// ------------------------
+	// String and printf on this platform stop at 32 bits
+	char buf[21];
+	char *p = buf + sizeof(buf) - 1;
+	*p = 0;
+	do	{
+		*--p = '0' + (value % 10);
+		value /= 10;
+	} while(value);
+	return String(p);
+}
+
+
+
 // ------------------------
 bool ESPWebDAV::isClientWaiting() {
 // ------------------------
@@ -89,7 +153,17 @@ bool ESPWebDAV::isClientWaiting() {
 // ------------------------
 void ESPWebDAV::handleClient(String blank) {
 // ------------------------
+	// chip select edges from the interrupt get their time
+	if(_bus)
+		_bus->poll();
+	// the card is mounted and read while nobody is waiting
+	if(!isClientWaiting())
+		warmUp();
 	processClient(&ESPWebDAV::handleRequest, blank);
+	// merge filename index changes once the client has its response
+	syncSearchIndex();
+	// the bus is kept only while a request needs it
+	releaseBus();
 }
 
 
@@ -116,14 +190,29 @@ void ESPWebDAV::processClient(THandlerFunction handler, String message) {
 	
 	// reset all variables
 	_chunked = false;
+	memset(&_sendStats, 0, sizeof(_sendStats));
+	setSendMode(SEND_SMALL);
 	_responseHeaders = String();
 	_contentLength = CONTENT_LENGTH_NOT_SET;
+	_compress = COMPRESS_OFF;
+	_gzip = NULL;
 	method = String();
 	uri = String();
+	query = String();
 	contentLengthHeader = String();
 	depthHeader = String();
 	hostHeader = String();
 	destinationHeader = String();
+	acceptHeader = String();
+	acceptEncodingHeader = String();
+	contentRangeHeader = String();
+	contentTypeHeader = String();
+	digestHeader = String();
+#if DAV_ENABLE_DIGEST
+	_digest.begin(DIGEST_NONE);
+#endif
+	_busLost = false;
+	updateRangeHeader = String();
 
 	// extract uri, headers etc
 	if(parseRequest())
@@ -131,6 +220,7 @@ void ESPWebDAV::processClient(THandlerFunction handler, String message) {
 		(this->*handler)(message);
 		
 	// finalize the response
+	finishCompression();
 	if(_chunked)
 		sendContent("");
 
@@ -160,7 +250,14 @@ bool ESPWebDAV::parseRequest() {
 	}
 
 	method = req.substring(0, addr_start);
-	uri = urlDecode(req.substring(addr_start + 1, addr_end));
+	// query string is kept apart and decoded per argument
+	String url = req.substring(addr_start + 1, addr_end);
+	int queryStart = url.indexOf('?');
+	if(queryStart >= 0)	{
+		query = url.substring(queryStart + 1);
+		url = url.substring(0, queryStart);
+	}
+	uri = urlDecode(url);
 	// DBG_PRINT("method: "); DBG_PRINT(method); DBG_PRINT(" url: "); DBG_PRINTLN(uri);
 	
 	// parse and finish all headers
@@ -190,6 +287,26 @@ bool ESPWebDAV::parseRequest() {
 			contentLengthHeader = headerValue;
 		else if(headerName.equalsIgnoreCase("Destination"))
 			destinationHeader = headerValue;
+		else if(headerName.equalsIgnoreCase("Accept"))
+			acceptHeader = headerValue;
+		else if(headerName.equalsIgnoreCase("Accept-Encoding"))
+			acceptEncodingHeader = headerValue;
+		else if(headerName.equalsIgnoreCase("Content-Type"))
+			contentTypeHeader = headerValue;
+		else if(headerName.equalsIgnoreCase("Content-MD5"))
+			setDigestHeader(FIELD_CONTENT_MD5, false, "md5=" + headerValue);
+		else if(headerName.equalsIgnoreCase("Digest"))
+			setDigestHeader(FIELD_DIGEST, false, headerValue);
+		else if(headerName.equalsIgnoreCase("Repr-Digest") || headerName.equalsIgnoreCase("Content-Digest"))
+			setDigestHeader(FIELD_REPR_DIGEST, false, headerValue);
+		else if(headerName.equalsIgnoreCase("Want-Digest"))
+			setDigestHeader(FIELD_DIGEST, true, headerValue);
+		else if(headerName.equalsIgnoreCase("Want-Repr-Digest") || headerName.equalsIgnoreCase("Want-Content-Digest"))
+			setDigestHeader(FIELD_REPR_DIGEST, true, headerValue);
+		else if(headerName.equalsIgnoreCase("Content-Range"))
+			contentRangeHeader = headerValue;
+		else if(headerName.equalsIgnoreCase("X-Update-Range"))
+			updateRangeHeader = headerValue;
 	}
 	
 	return true;
@@ -198,6 +315,108 @@ bool ESPWebDAV::parseRequest() {
 
 
 
+// ------------------------
+void ESPWebDAV::setDigestHeader(DigestField field, bool wanted, const String& value)	{
+// ------------------------
+	// a digest to check beats a request for one, newer fields beat older ones
+	if(!digestHeader.length() || (digestWanted && !wanted) || (digestWanted == wanted && field > digestField))	{
+		digestHeader = value;
+		digestField = field;
+		digestWanted = wanted;
+	}
+}
+
+
+
+// ------------------------
+String ESPWebDAV::queryArg(const char *name)	{
+// ------------------------
+	// value of name in the query string, empty if not there
+	int idx = 0;
+	while(idx < (int) query.length())	{
+		int end = query.indexOf('&', idx);
+		if(end < 0)
+			end = query.length();
+
+		String pair = query.substring(idx, end);
+		int eqIdx = pair.indexOf('=');
+		if((eqIdx < 0 ? pair : pair.substring(0, eqIdx)).equals(name))
+			return (eqIdx < 0) ? String() : urlDecode(pair.substring(eqIdx + 1));
+		idx = end + 1;
+	}
+	return String();
+}
+
+
+
+// ------------------------
+String ESPWebDAV::readBody(size_t maxLen)	{
+// ------------------------
+	// request body as text, anything past maxLen is read and dropped
+	size_t numRemaining = contentLengthHeader.toInt();
+	String body;
+	body.reserve((numRemaining < maxLen) ? numRemaining : maxLen);
+
+	uint8_t buf[128];
+	while(numRemaining > 0)	{
+		size_t numToRead = (numRemaining > sizeof(buf)) ? sizeof(buf) : numRemaining;
+		size_t numRead = readBytesWithTimeout(buf, numToRead, numToRead);
+		if(numRead == 0)
+			break;
+
+		for(size_t i = 0; i < numRead && body.length() < maxLen; i++)
+			body += (char) buf[i];
+		numRemaining -= numRead;
+	}
+	return body;
+}
+
+
+
+// ------------------------
+int ESPWebDAV::findElement(const String& xml, const char *name, int from)	{
+// ------------------------
+	// next start tag with this local name, whatever the namespace prefix
+	int idx = from;
+	while((idx = xml.indexOf('<', idx)) >= 0)	{
+		int nameStart = idx + 1;
+		int nameEnd = nameStart;
+		while(nameEnd < (int) xml.length() && !strchr(" \t\r\n/>", xml.charAt(nameEnd)))	{
+			if(xml.charAt(nameEnd) == ':')
+				nameStart = nameEnd + 1;
+			nameEnd++;
+		}
+
+		if(xml.charAt(idx + 1) != '/' && xml.substring(nameStart, nameEnd).equals(name))
+			return idx;
+		idx++;
+	}
+	return -1;
+}
+
+
+
+// ------------------------
+String ESPWebDAV::elementText(const String& xml, int idx)	{
+// ------------------------
+	// text content of the element starting at idx
+	int start = xml.indexOf('>', idx);
+	if(start < 0 || xml.charAt(start - 1) == '/')
+		return String();
+
+	int end = xml.indexOf('<', start + 1);
+	String text = xml.substring(start + 1, (end < 0) ? xml.length() : end);
+	text.trim();
+	text.replace("&lt;", "<");
+	text.replace("&gt;", ">");
+	text.replace("&quot;", "\"");
+	text.replace("&apos;", "'");
+	text.replace("&amp;", "&");
+	return text;
+}
+
+
+
 // ------------------------
 void ESPWebDAV::sendHeader(const String& name, const String& value, bool first) {
 // ------------------------
@@ -214,10 +433,21 @@ void ESPWebDAV::sendHeader(const String& name, const String& value, bool first)
 // ------------------------
 void ESPWebDAV::send(String code, const char* content_type, const String& content) {
 // ------------------------
+#if DAV_ENABLE_GZIP
+	if(_compress == COMPRESS_HOLD)	{
+		// header waits until the body shows whether compression pays
+		_heldCode = code;
+		_heldType = content_type ? content_type : "";
+		if(content.length())
+			sendContent(content);
+		return;
+	}
+#endif
+
 	String header;
 	_prepareHeader(header, code, content_type, content.length());
 
-	client.write(header.c_str(), header.length());
+	sendBytes((const uint8_t *) header.c_str(), header.length());
 	if(content.length())
 		sendContent(content);
 }
@@ -251,23 +481,43 @@ void ESPWebDAV::_prepareHeader(String& response, String code, const char* conten
 
 // ------------------------
 void ESPWebDAV::sendContent(const String& content) {
+// ------------------------
+#if DAV_ENABLE_GZIP
+	if(_compress == COMPRESS_HOLD)	{
+		_heldBody += content;
+		if(_heldBody.length() >= DAVConfig::gzipThreshold)
+			startCompression();
+		return;
+	}
+	if(_compress == COMPRESS_ON)	{
+		_gzip->write((const uint8_t *) content.c_str(), content.length());
+		return;
+	}
+#endif
+
+	sendChunk((const uint8_t *) content.c_str(), content.length());
+}
+
+
+
+// ------------------------
+void ESPWebDAV::sendChunk(const uint8_t *buf, size_t size) {
 // ------------------------
 	const char * footer = "\r\n";
-	size_t size = content.length();
 	
 	if(_chunked) {
 		char * chunkSize = (char *) malloc(11);
 		if(chunkSize) {
 			sprintf(chunkSize, "%x%s", size, footer);
-			client.write(chunkSize, strlen(chunkSize));
+			sendBytes((const uint8_t *) chunkSize, strlen(chunkSize));
 			free(chunkSize);
 		}
 	}
 	
-	client.write(content.c_str(), size);
+	sendBytes(buf, size);
 	
 	if(_chunked) {
-		client.write(footer, 2);
+		sendBytes((const uint8_t *) footer, 2);
 		if (size == 0) {
 			_chunked = false;
 		}
@@ -279,6 +529,9 @@ void ESPWebDAV::sendContent(const String& content) {
 // ------------------------
 void ESPWebDAV::sendContent_P(PGM_P content) {
 // ------------------------
+	if(_compress != COMPRESS_OFF)
+		return sendContent(String(FPSTR(content)));
+
 	const char * footer = "\r\n";
 	size_t size = strlen_P(content);
 	
@@ -286,15 +539,23 @@ void ESPWebDAV::sendContent_P(PGM_P content) {
 		char * chunkSize = (char *) malloc(11);
 		if(chunkSize) {
 			sprintf(chunkSize, "%x%s", size, footer);
-			client.write(chunkSize, strlen(chunkSize));
+			sendBytes((const uint8_t *) chunkSize, strlen(chunkSize));
 			free(chunkSize);
 		}
 	}
 	
-	client.write_P(content, size);
+	// through a small RAM buffer, so a partial write is offered again like any other
+	char buf[64];
+	for(size_t numSent = 0; numSent < size; )	{
+		size_t numCopy = (size - numSent < sizeof(buf)) ? size - numSent : sizeof(buf);
+		memcpy_P(buf, content + numSent, numCopy);
+		if(sendBytes((const uint8_t *) buf, numCopy) < numCopy)
+			break;
+		numSent += numCopy;
+	}
 	
 	if(_chunked) {
-		client.write(footer, 2);
+		sendBytes((const uint8_t *) footer, 2);
 		if (size == 0) {
 			_chunked = false;
 		}
@@ -303,6 +564,141 @@ void ESPWebDAV::sendContent_P(PGM_P content) {
 
 
 
+// ------------------------
+void ESPWebDAV::chunkPut(ChunkBuffer *cb, const uint8_t *data, size_t len)	{
+// ------------------------
+	// NULL data adds zeros
+	while(len && cb->ok)	{
+		size_t numCopy = DAVConfig::sendBuffer - cb->len;
+		if(numCopy > len)
+			numCopy = len;
+		if(data)	{
+			memcpy(cb->buf + DAV_CHUNK_HEAD + cb->len, data, numCopy);
+			data += numCopy;
+		}
+		else
+			memset(cb->buf + DAV_CHUNK_HEAD + cb->len, 0, numCopy);
+		cb->len += numCopy;
+		len -= numCopy;
+
+		if(cb->len == DAVConfig::sendBuffer)
+			chunkFlush(cb);
+	}
+}
+
+
+
+// ------------------------
+bool ESPWebDAV::chunkFlush(ChunkBuffer *cb)	{
+// ------------------------
+	if(!cb->len || !cb->ok)
+		return cb->ok;
+
+	// size line right in front of the data and CRLF after it, one write for all
+	char head[DAV_CHUNK_HEAD + 1];
+	size_t headLen = sprintf(head, "%x\r\n", cb->len);
+	uint8_t *start = cb->buf + DAV_CHUNK_HEAD - headLen;
+	memcpy(start, head, headLen);
+	memcpy(cb->buf + DAV_CHUNK_HEAD + cb->len, "\r\n", 2);
+
+	size_t numToSend = headLen + cb->len + 2;
+	cb->ok = (sendBytes(start, numToSend) == numToSend);
+	cb->len = 0;
+	return cb->ok;
+}
+
+
+
+// ------------------------
+void ESPWebDAV::compressResponse()	{
+// ------------------------
+	// called before send(), the coding is picked once the body is long enough
+	if(!DAVConfig::gzip)
+		return;
+
+	int idx = acceptEncodingHeader.indexOf("gzip");
+	if(idx < 0)
+		return;
+
+	// gzip;q=0 refuses it
+	int end = acceptEncodingHeader.indexOf(',', idx);
+	String coding = acceptEncodingHeader.substring(idx, (end < 0) ? acceptEncodingHeader.length() : end);
+	int qIdx = coding.indexOf("q=");
+	if(qIdx >= 0 && coding.substring(qIdx + 2).toFloat() == 0)
+		return;
+
+	_compress = COMPRESS_HOLD;
+}
+
+
+
+// ------------------------
+void ESPWebDAV::startCompression()	{
+// ------------------------
+#if DAV_ENABLE_GZIP
+	_gzip = new GzipStream(gzipSink, this);
+	if(!_gzip)	{
+		// no memory, the rest goes out plain
+		finishCompression();
+		return;
+	}
+
+	_compress = COMPRESS_ON;
+	sendHeader("Content-Encoding", "gzip");
+	sendHeader("Vary", "Accept-Encoding");
+	sendHeldHeader();
+	_gzip->write((const uint8_t *) _heldBody.c_str(), _heldBody.length());
+	_heldBody = String();
+#endif
+}
+
+
+
+// ------------------------
+void ESPWebDAV::finishCompression()	{
+// ------------------------
+#if DAV_ENABLE_GZIP
+	if(_compress == COMPRESS_HOLD)	{
+		// short body, not worth compressing
+		_compress = COMPRESS_OFF;
+		sendHeldHeader();
+		if(_heldBody.length())
+			sendContent(_heldBody);
+	}
+	else if(_compress == COMPRESS_ON)	{
+		_gzip->finish();
+		DBG_PRINT("gzip: "); DBG_PRINT(_gzip->inputSize()); DBG_PRINT(" -> "); DBG_PRINTLN(_gzip->outputSize());
+		delete _gzip;
+		_gzip = NULL;
+		_compress = COMPRESS_OFF;
+	}
+	_heldBody = String();
+#endif
+}
+
+
+
+// ------------------------
+void ESPWebDAV::sendHeldHeader()	{
+// ------------------------
+#if DAV_ENABLE_GZIP
+	String header;
+	_prepareHeader(header, _heldCode, _heldType.length() ? _heldType.c_str() : NULL, 0);
+	sendBytes((const uint8_t *) header.c_str(), header.length());
+#endif
+}
+
+
+
+// ------------------------
+void ESPWebDAV::gzipSink(void *ctx, const uint8_t *data, size_t len)	{
+// ------------------------
+	// compressed output goes out as it is, one chunk per buffer
+	((ESPWebDAV *) ctx)->sendChunk(data, len);
+}
+
+
+
 // ------------------------
 void ESPWebDAV::setContentLength(size_t len)	{
 // ------------------------
@@ -313,7 +709,7 @@ void ESPWebDAV::setContentLength(size_t len)	{
 // ------------------------
 size_t ESPWebDAV::readBytesWithTimeout(uint8_t *buf, size_t bufSize) {
 // ------------------------
-	int timeout_ms = HTTP_MAX_POST_WAIT;
+	int timeout_ms = DAVConfig::postWait;
 	size_t numAvailable = 0;
 	while(!(numAvailable = client.available()) && client.connected() && timeout_ms--) 
 		delay(1);
@@ -328,7 +724,7 @@ size_t ESPWebDAV::readBytesWithTimeout(uint8_t *buf, size_t bufSize) {
 // ------------------------
 size_t ESPWebDAV::readBytesWithTimeout(uint8_t *buf, size_t bufSize, size_t numToRead) {
 // ------------------------
-	int timeout_ms = HTTP_MAX_POST_WAIT;
+	int timeout_ms = DAVConfig::postWait;
 	size_t numAvailable = 0;
 	
 	while(((numAvailable = client.available()) < numToRead) && client.connected() && timeout_ms--) 
@@ -341,3 +737,99 @@ size_t ESPWebDAV::readBytesWithTimeout(uint8_t *buf, size_t bufSize, size_t numT
 }
 
 
+
+// ------------------------
+size_t ESPWebDAV::readFull(uint8_t *buf, size_t len) {
+// ------------------------
+	// keep reading until len bytes arrived, less only on timeout
+	size_t numRead = 0;
+	while(numRead < len)	{
+		size_t numNow = readBytesWithTimeout(buf + numRead, len - numRead, len - numRead);
+		if(numNow == 0)
+			break;
+		numRead += numNow;
+	}
+	return numRead;
+}
+
+
+
+// ------------------------
+void ESPWebDAV::setSendMode(SendMode mode)	{
+// ------------------------
+	// small XML pieces: let Nagle coalesce them into fewer segments
+	// bulk: writes are whole segments, push them out without waiting for ACKs
+	client.setNoDelay(mode == SEND_BULK);
+}
+
+
+
+// ------------------------
+size_t ESPWebDAV::sendBytes(const uint8_t *buf, size_t len)	{
+// ------------------------
+	// the stack may accept only part of the buffer under backpressure
+	// keep offering the unsent tail until all of it is taken
+	size_t numSent = 0;
+	bool waited = false;
+	while(numSent < len)	{
+		size_t numWritten = client.write(buf + numSent, len - numSent);
+		numSent += numWritten;
+		if(numWritten)	{
+			waited = false;
+			continue;
+		}
+
+		// nothing taken even though the window opened, connection is unusable
+		if(waited || !waitForSendWindow())
+			break;
+		waited = true;
+	}
+
+	_sendStats.bytes += numSent;
+	return numSent;
+}
+
+
+
+// ------------------------
+bool ESPWebDAV::waitForSendWindow()	{
+// ------------------------
+	_sendStats.stalls++;
+	unsigned long tStart = millis();
+	unsigned long waited = 0;
+
+#if defined(ESP32)
+	// a write that took nothing gave up inside the stack, wait on the
+	// socket until it takes data again
+	int fd = client.fd();
+	fd_set writeSet;
+	FD_ZERO(&writeSet);
+	if(fd >= 0)
+		FD_SET(fd, &writeSet);
+	struct timeval tv;
+	tv.tv_sec = DAVConfig::sendWait / 1000;
+	tv.tv_usec = (DAVConfig::sendWait % 1000) * 1000;
+	if(fd < 0 || select(fd + 1, NULL, &writeSet, NULL, &tv) <= 0 || !client.connected())	{
+		_sendStats.waitMs += millis() - tStart;
+		DBG_PRINTLN("Send window did not open");
+		return false;
+	}
+#else
+	// wait for ACKs to open the window, delay lets the stack run
+	while(client.availableForWrite() == 0)	{
+		waited = millis() - tStart;
+		if(!client.connected() || waited > DAVConfig::sendWait)	{
+			_sendStats.waitMs += waited;
+			DBG_PRINTLN("Send window did not open");
+			return false;
+		}
+		delay(1);
+	}
+#endif
+
+	waited = millis() - tStart;
+	_sendStats.waitMs += waited;
+	if(waited >= DAVConfig::retransmitWait)
+		_sendStats.retransmitWaits++;
+	return client.connected();
+}
@@ -36,11 +36,8 @@ const char *ssid = 		"ssid";
 const char *password = 	"password";
 
 ESPWebDAV dav;
-String statusMessage;
-bool initFailed = false;
-
-volatile long spiBlockoutTime = 0;
-bool weHaveBus = false;
+// shares the card with Marlin, long transfers hand the bus back between bursts
+BusArbiter bus;
 
 
 
@@ -50,9 +47,9 @@ void setup() {
 	// ----- GPIO -------
 	// Detect when other master uses SPI bus
 	pinMode(CS_SENSE, INPUT);
+	bus.begin(switchBus, SPI_BLOCKOUT_PERIOD);
 	attachInterrupt(CS_SENSE, []() {
-		if(!weHaveBus)
-			spiBlockoutTime = millis() + SPI_BLOCKOUT_PERIOD;
+		bus.otherMasterActive();
 	}, FALLING);
 	
 	DBG_INIT(115200);
@@ -60,8 +57,8 @@ void setup() {
 	INIT_LED;
 	blink();
 	
-	// wait for other master to assert SPI bus first
-	delay(SPI_BLOCKOUT_PERIOD);
+	// boot counts as bus use, Marlin reads the card first
+	bus.otherMasterActive();
 
 	// ----- WIFI -------
 	// Set hostname first
@@ -86,24 +83,9 @@ void setup() {
 
 
 	// ----- SD Card and Server -------
-	// Check to see if other master is using the SPI bus
-	while(millis() < spiBlockoutTime)
-		blink();
-	
-	takeBusControl();
-	
-	// start the SD DAV server
-	if(!dav.init(SD_CS, SPI_FULL_SPEED, SERVER_PORT))		{
-		statusMessage = "Failed to initialize SD Card";
-		DBG_PRINT("ERROR: "); DBG_PRINTLN(statusMessage);
-		// indicate error on LED
-		errorBlink();
-		initFailed = true;
-	}
-	else
-		blink();
-
-	relenquishBusControl();
+	// start the DAV server, the card is mounted once the blockout is over
+	dav.setBusArbiter(&bus);
+	dav.init(SD_CS, SPI_FULL_SPEED, SERVER_PORT);
 	DBG_PRINTLN("WebDAV server started");
 }
 
@@ -112,23 +94,23 @@ void setup() {
 // ------------------------
 void loop() {
 // ------------------------
-	if(millis() < spiBlockoutTime)
+	if(bus.isBlocked())
 		blink();
 
-	// do it only if there is a need to read FS
-	if(dav.isClientWaiting())	{
-		if(initFailed)
-			return dav.rejectClient(statusMessage);
-		
-		// has other master been using the bus in last few seconds
-		if(millis() < spiBlockoutTime)
-			return dav.rejectClient("Marlin is reading from SD card");
-		
-		// a client is waiting and FS is ready and other SPI master is not using the bus
+	// every pass, between requests it mounts and reads the card in short slices
+	// 503 with Retry-After until the card is ready or while Marlin has been using the bus
+	dav.handleClient();
+}
+
+
+
+// ------------------------
+void switchBus(bool take)	{
+// ------------------------
+	if(take)
 		takeBusControl();
-		dav.handleClient();
+	else
 		relenquishBusControl();
-	}
 }
 
 
@@ -136,7 +118,6 @@ void loop() {
 // ------------------------
 void takeBusControl()	{
 // ------------------------
-	weHaveBus = true;
 	LED_ON;
 	pinMode(MISO, SPECIAL);	
 	pinMode(MOSI, SPECIAL);	
@@ -154,7 +135,6 @@ void relenquishBusControl()	{
 	pinMode(SCLK, INPUT);	
 	pinMode(SD_CS, INPUT);
 	LED_OFF;
-	weHaveBus = false;
 }
 
 
@@ -171,16 +151,3 @@ void blink()	{
 
 
 
-// ------------------------
-void errorBlink()	{
-// ------------------------
-	for(int i = 0; i < 100; i++)	{
-		LED_ON; 
-		delay(50); 
-		LED_OFF; 
-		delay(50);
-	}
-}
-
-
-
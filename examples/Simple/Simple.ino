@@ -16,8 +16,6 @@ const char *ssid = 		"ssid";
 const char *password = 	"passwd";
 
 ESPWebDAV dav;
-String statusMessage;
-bool initFailed = false;
 
 
 // ------------------------
@@ -43,13 +41,8 @@ void setup() {
 	Serial.print ("RSSI: "); Serial.println(WiFi.RSSI());
 	Serial.print ("Mode: "); Serial.println(WiFi.getPhyMode());
 	
-	// start the SD DAV server
-	if(!dav.init(SD_CS, SPI_FULL_SPEED, SERVER_PORT))		{
-		statusMessage = "Failed to initialize SD Card";
-		Serial.print("ERROR: "); Serial.println(statusMessage);
-		initFailed = true;
-	}
-
+	// start the DAV server, the SD card is mounted from loop
+	dav.init(SD_CS, SPI_FULL_SPEED, SERVER_PORT);
 	Serial.println("WebDAV server started");
 }
 
@@ -58,13 +51,9 @@ void setup() {
 // ------------------------
 void loop() {
 // ------------------------
-	if(dav.isClientWaiting())	{
-		if(initFailed)
-			return dav.rejectClient(statusMessage);
-
-		// call handle if server was initialized properly
-		dav.handleClient();
-	}
+	// every pass, between requests it mounts and reads the card in short slices
+	// until then requests get 503 with Retry-After
+	dav.handleClient();
 }
 
 
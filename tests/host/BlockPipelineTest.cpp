@@ -0,0 +1,227 @@
+// Host test and benchmark of BlockRing and BlockPipeline.
+// Built twice by the Makefile: threads as on the host and ESP32, and
+// bursts as on ESP8266 (BLOCK_PIPELINE_COOPERATIVE).
+//   ./BlockPipelineTest            run the checks
+//   ./BlockPipelineTest bench      time a transfer with a slow side
+
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <thread>
+#include "BlockPipeline.h"
+
+#define TEST_BLOCK		512
+#define TEST_DEPTH		4
+
+typedef BlockRing<TEST_BLOCK, TEST_DEPTH> TestRing;
+typedef BlockPipeline<TestRing> TestPipeline;
+
+static int numFailed = 0;
+
+#define CHECK(cond)	do { if(!(cond))	{ printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); numFailed++; } } while(0)
+
+
+// both ends of a transfer, data is a counting byte pattern
+struct Transfer	{
+	size_t total;			// bytes the producer hands out
+	size_t produced;
+	size_t consumed;
+	size_t abortAfter;		// consumer fails once this many bytes arrived, 0 never
+	bool orderOk;
+	uint32_t producerDelayUs;
+	uint32_t consumerDelayUs;
+};
+
+
+// ------------------------
+static size_t produce(void *ctx, uint8_t *data, size_t size)	{
+// ------------------------
+	Transfer *xfer = (Transfer *) ctx;
+	if(xfer->producerDelayUs)
+		std::this_thread::sleep_for(std::chrono::microseconds(xfer->producerDelayUs));
+
+	size_t numLeft = xfer->total - xfer->produced;
+	size_t num = (numLeft < size) ? numLeft : size;
+	for(size_t i = 0; i < num; i++)
+		data[i] = (uint8_t) (xfer->produced + i);
+	xfer->produced += num;
+	return num;
+}
+
+
+
+// ------------------------
+static bool consume(void *ctx, const uint8_t *data, size_t length)	{
+// ------------------------
+	Transfer *xfer = (Transfer *) ctx;
+	if(xfer->consumerDelayUs)
+		std::this_thread::sleep_for(std::chrono::microseconds(xfer->consumerDelayUs));
+
+	for(size_t i = 0; i < length; i++)
+		if(data[i] != (uint8_t) (xfer->consumed + i))
+			xfer->orderOk = false;
+	xfer->consumed += length;
+	return !xfer->abortAfter || xfer->consumed < xfer->abortAfter;
+}
+
+
+
+// ------------------------
+static Transfer newTransfer(size_t total)	{
+// ------------------------
+	Transfer xfer;
+	memset(&xfer, 0, sizeof(xfer));
+	xfer.total = total;
+	xfer.orderOk = true;
+	return xfer;
+}
+
+
+
+// ------------------------
+static void testRing()	{
+// ------------------------
+	TestRing *ring = new TestRing();
+	CHECK(ring->isEmpty());
+	CHECK(!ring->isFull());
+	CHECK(ring->consumerSlot() == NULL);
+
+	// fill, then each release frees exactly one slot, across the wrap
+	for(int round = 0; round < 3; round++)	{
+		for(size_t i = 0; i < TEST_DEPTH; i++)	{
+			TestRing::Block *blk = ring->producerSlot();
+			CHECK(blk != NULL);
+			blk->length = round * TEST_DEPTH + i;
+			ring->producerCommit();
+		}
+		CHECK(ring->isFull());
+		CHECK(ring->producerSlot() == NULL);
+
+		for(size_t i = 0; i < TEST_DEPTH; i++)	{
+			TestRing::Block *blk = ring->consumerSlot();
+			CHECK(blk != NULL && blk->length == round * TEST_DEPTH + i);
+			ring->consumerRelease();
+		}
+		CHECK(ring->isEmpty());
+	}
+	CHECK(ring->stats.blocks == 3 * TEST_DEPTH);
+
+	CHECK(!ring->isDone());
+	ring->close();
+	CHECK(ring->isDone());
+	ring->reset();
+	CHECK(!ring->isClosed() && ring->isEmpty() && ring->stats.blocks == 0);
+	delete ring;
+}
+
+
+
+// ------------------------
+static void testTransfer(size_t total)	{
+// ------------------------
+	// every byte arrives once and in order, the last block may be short
+	TestRing *ring = new TestRing();
+	Transfer xfer = newTransfer(total);
+	TestPipeline pipe(ring, produce, consume, &xfer);
+
+	CHECK(pipe.run());
+	CHECK(xfer.orderOk);
+	CHECK(xfer.consumed == total);
+	CHECK(ring->stats.blocks == (total + TEST_BLOCK - 1) / TEST_BLOCK);
+	delete ring;
+}
+
+
+
+// ------------------------
+static void testAbort()	{
+// ------------------------
+	// a failing consumer ends the transfer, the producer stops early
+	TestRing *ring = new TestRing();
+	Transfer xfer = newTransfer(1000 * TEST_BLOCK);
+	xfer.abortAfter = 10 * TEST_BLOCK;
+	TestPipeline pipe(ring, produce, consume, &xfer);
+
+	CHECK(!pipe.run());
+	CHECK(xfer.consumed == xfer.abortAfter);
+	CHECK(xfer.produced <= xfer.abortAfter + (TEST_DEPTH + 1) * TEST_BLOCK);
+	delete ring;
+}
+
+
+
+// ------------------------
+static void testStalls()	{
+// ------------------------
+	// slow consumer: the producer finds the ring full
+	TestRing *ring = new TestRing();
+	Transfer xfer = newTransfer(64 * TEST_BLOCK);
+	xfer.consumerDelayUs = 200;
+	TestPipeline slowConsumer(ring, produce, consume, &xfer);
+	CHECK(slowConsumer.run());
+	CHECK(ring->stats.producerStalls > 0);
+
+#if defined(BLOCK_PIPELINE_THREADS)
+	// slow producer: the consumer finds the ring empty
+	xfer = newTransfer(64 * TEST_BLOCK);
+	xfer.producerDelayUs = 200;
+	TestPipeline slowProducer(ring, produce, consume, &xfer);
+	CHECK(slowProducer.run());
+	CHECK(ring->stats.consumerStalls > 0);
+#endif
+	delete ring;
+}
+
+
+
+// ------------------------
+static void bench()	{
+// ------------------------
+	// both sides cost the same, overlapped the transfer takes about half as long
+	const size_t numBlocks = 2000;
+	const uint32_t costUs = 50;
+	uint8_t buf[TEST_BLOCK];
+
+	Transfer xfer = newTransfer(numBlocks * TEST_BLOCK);
+	xfer.producerDelayUs = xfer.consumerDelayUs = costUs;
+	auto tStart = std::chrono::steady_clock::now();
+	for(size_t num; (num = produce(&xfer, buf, sizeof(buf))); )
+		consume(&xfer, buf, num);
+	double serialMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - tStart).count();
+
+	TestRing *ring = new TestRing();
+	xfer = newTransfer(numBlocks * TEST_BLOCK);
+	xfer.producerDelayUs = xfer.consumerDelayUs = costUs;
+	tStart = std::chrono::steady_clock::now();
+	TestPipeline pipe(ring, produce, consume, &xfer);
+	bool runOk = pipe.run();
+	double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - tStart).count();
+
+	printf("%s: %zu blocks in %.1f ms (%.2f MB/s), one after the other %.1f ms\n",
+		runOk ? "ok" : "failed", numBlocks, ms, numBlocks * TEST_BLOCK / ms / 1000.0, serialMs);
+	printf("producer stalls: %u consumer stalls: %u\n", ring->stats.producerStalls, ring->stats.consumerStalls);
+	delete ring;
+}
+
+
+
+// ------------------------
+int main(int argc, char **argv)	{
+// ------------------------
+	if(argc > 1 && !strcmp(argv[1], "bench"))	{
+		bench();
+		return 0;
+	}
+
+	testRing();
+	testTransfer(0);
+	testTransfer(1);
+	testTransfer(TEST_BLOCK);
+	testTransfer(TEST_DEPTH * TEST_BLOCK + 7);
+	testTransfer(300 * TEST_BLOCK + 100);
+	testAbort();
+	testStalls();
+
+	printf("%s: %d failed\n", argv[0], numFailed);
+	return numFailed ? 1 : 0;
+}
@@ -0,0 +1,233 @@
+// Host test of BusArbiter on a simulated clock. The other master is a
+// chip select line that falls every few ms while it is busy, each fall
+// calls otherMasterActive as the interrupt would.
+//   ./BusArbiterTest
+
+#include <stdio.h>
+#include "BusArbiter.h"
+
+#define TEST_BLOCKOUT	3000
+
+static int numFailed = 0;
+
+#define CHECK(cond)	do { if(!(cond))	{ printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); numFailed++; } } while(0)
+
+
+static BusArbiter bus;
+static uint32_t clockMs;
+static bool pinsTaken;
+
+// the other master's chip select: falls every csPeriod ms in [csFrom, csUntil)
+static uint32_t csFrom, csUntil, csPeriod;
+
+
+
+// ------------------------
+static uint32_t fakeClock()	{
+// ------------------------
+	return clockMs;
+}
+
+
+
+// ------------------------
+static void fakeSleep(uint32_t ms)	{
+// ------------------------
+	// time passes one ms at a time, the line falls when it is due
+	while(ms--)	{
+		clockMs++;
+		if(csPeriod && clockMs >= csFrom && clockMs < csUntil && (clockMs - csFrom) % csPeriod == 0)
+			bus.otherMasterActive();
+	}
+}
+
+
+
+// ------------------------
+static void switchBus(bool take)	{
+// ------------------------
+	pinsTaken = take;
+}
+
+
+
+// ------------------------
+static void otherMasterBusy(uint32_t fromMs, uint32_t forMs, uint32_t everyMs)	{
+// ------------------------
+	csFrom = fromMs;
+	csUntil = fromMs + forMs;
+	csPeriod = everyMs;
+}
+
+
+
+// ------------------------
+static void reset()	{
+// ------------------------
+	clockMs = 100000;
+	pinsTaken = false;
+	csPeriod = 0;
+	bus.setClock(fakeClock, fakeSleep);
+	bus.begin(switchBus, TEST_BLOCKOUT);
+}
+
+
+
+// ------------------------
+static void testIdle()	{
+// ------------------------
+	// nobody else on the bus: taken at once, pins follow
+	reset();
+	CHECK(!bus.isBlocked());
+	CHECK(bus.acquire());
+	CHECK(bus.isHeld() && pinsTaken);
+	CHECK(bus.acquire());
+	fakeSleep(40);
+	bus.release();
+	CHECK(!bus.isHeld() && !pinsTaken);
+	CHECK(bus.stats().leases == 1);
+	CHECK(bus.stats().holdMs == 40 && bus.stats().longestHoldMs == 40);
+}
+
+
+
+// ------------------------
+static void testBlockout()	{
+// ------------------------
+	// an edge blocks the bus for the blockout period after it
+	reset();
+	bus.otherMasterActive();
+	bus.poll();
+	CHECK(bus.isBlocked());
+	CHECK(!bus.acquire());
+	CHECK(bus.retryAfter() == 3);
+	CHECK(bus.stats().denied == 1 && bus.stats().edges == 1);
+	// work that is not a request is not counted
+	CHECK(!bus.acquire(false));
+	CHECK(bus.stats().denied == 1);
+
+	fakeSleep(TEST_BLOCKOUT - 1500);
+	CHECK(bus.isBlocked());
+	CHECK(bus.retryAfter() == 2);
+
+	fakeSleep(1500);
+	CHECK(!bus.isBlocked());
+	CHECK(bus.acquire(false));
+	bus.release();
+	CHECK(bus.acquire());
+	CHECK(bus.stats().leases == 1);
+}
+
+
+
+// ------------------------
+static void testEdgeTime()	{
+// ------------------------
+	// the interrupt only counts, the blockout starts when the edge is first seen
+	reset();
+	bus.otherMasterActive();
+	fakeSleep(500);
+	CHECK(bus.isBlocked());
+	fakeSleep(TEST_BLOCKOUT - 1);
+	CHECK(bus.isBlocked());
+	fakeSleep(1);
+	CHECK(!bus.isBlocked());
+}
+
+
+
+// ------------------------
+static void testOwnEdges()	{
+// ------------------------
+	// our own chip select while the bus is held is not the other master
+	reset();
+	CHECK(bus.acquire());
+	bus.otherMasterActive();
+	bus.otherMasterActive();
+	bus.release();
+	CHECK(!bus.isBlocked());
+	CHECK(bus.stats().edges == 0);
+}
+
+
+
+// ------------------------
+static void testLease()	{
+// ------------------------
+	reset();
+	CHECK(!bus.leaseExpired());
+	CHECK(bus.acquire());
+	fakeSleep(DAV_BUS_LEASE - 1);
+	CHECK(!bus.leaseExpired());
+	fakeSleep(1);
+	CHECK(bus.leaseExpired());
+}
+
+
+
+// ------------------------
+static void testHandOverQuiet()	{
+// ------------------------
+	// the other master does not want the bus: back after one gap
+	reset();
+	CHECK(bus.acquire());
+	fakeSleep(DAV_BUS_LEASE);
+	CHECK(bus.handOver());
+	CHECK(bus.isHeld() && pinsTaken);
+	CHECK(!bus.leaseExpired());
+	CHECK(bus.stats().handOvers == 1 && bus.stats().leases == 1);
+	CHECK(bus.stats().waitMs == DAV_BUS_GAP);
+}
+
+
+
+// ------------------------
+static void testHandOverBusy()	{
+// ------------------------
+	// the other master uses the gap for a while, the transfer resumes once it is quiet
+	reset();
+	CHECK(bus.acquire());
+	fakeSleep(DAV_BUS_LEASE);
+	otherMasterBusy(clockMs + 1, 400, 5);
+	CHECK(bus.handOver());
+	CHECK(bus.isHeld());
+	uint32_t lastEdge = csFrom + ((400 - 1) / 5) * 5;
+	CHECK(clockMs >= lastEdge + DAV_BUS_QUIET && clockMs <= lastEdge + DAV_BUS_QUIET + 1);
+	CHECK(bus.stats().lost == 0);
+}
+
+
+
+// ------------------------
+static void testHandOverLost()	{
+// ------------------------
+	// the other master keeps the bus: the transfer gives up after the wait
+	reset();
+	CHECK(bus.acquire());
+	fakeSleep(DAV_BUS_LEASE);
+	uint32_t tStart = clockMs;
+	otherMasterBusy(clockMs + 1, 2 * DAV_BUS_WAIT, 5);
+	CHECK(!bus.handOver());
+	CHECK(!bus.isHeld() && !pinsTaken);
+	CHECK(clockMs - tStart >= DAV_BUS_WAIT && clockMs - tStart <= DAV_BUS_WAIT + 1);
+	CHECK(bus.stats().lost == 1);
+	CHECK(bus.isBlocked());
+}
+
+
+
+// ------------------------
+int main(int, char **argv)	{
+// ------------------------
+	testIdle();
+	testBlockout();
+	testEdgeTime();
+	testOwnEdges();
+	testLease();
+	testHandOverQuiet();
+	testHandOverBusy();
+	testHandOverLost();
+
+	printf("%s: %d failed\n", argv[0], numFailed);
+	return numFailed ? 1 : 0;
+}
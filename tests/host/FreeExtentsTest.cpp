@@ -0,0 +1,149 @@
+// Host test of the free cluster run index, built with room for 4 runs so
+// the eviction of the smallest run is reached quickly.
+//   ./FreeExtentsTest
+
+#include <stdio.h>
+#include "FreeExtents.h"
+
+static int numFailed = 0;
+
+#define CHECK(cond)	do { if(!(cond))	{ printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); numFailed++; } } while(0)
+
+
+static FreeExtentIndex runs;
+
+
+
+// ------------------------
+static void scan(const char *fat)	{
+// ------------------------
+	// one character per cluster from cluster 2 on, '.' free and 'x' used
+	runs.clear();
+	for(uint32_t i = 0; fat[i]; i++)
+		runs.scanCluster(i + 2, fat[i] == '.');
+	runs.endScan();
+}
+
+
+
+// ------------------------
+static bool hasRun(uint32_t start, uint32_t length)	{
+// ------------------------
+	FreeExtent extent;
+	return runs.bestFit(length, &extent) && extent.start == start && extent.length == length;
+}
+
+
+
+// ------------------------
+static void testScan()	{
+// ------------------------
+	runs.clear();
+	CHECK(!runs.isReady());
+	// runs 2+2, 5+3, 9+1, 11+4
+	scan("..x...x.x....");
+	CHECK(runs.isReady());
+	CHECK(runs.count() == 4);
+	CHECK(runs.largest() == 4);
+}
+
+
+
+// ------------------------
+static void testBestFit()	{
+// ------------------------
+	// the smallest run that is long enough
+	scan("..x...x.x....");
+	FreeExtent extent;
+	CHECK(runs.bestFit(1, &extent) && extent.start == 9 && extent.length == 1);
+	CHECK(runs.bestFit(2, &extent) && extent.start == 2 && extent.length == 2);
+	CHECK(runs.bestFit(3, &extent) && extent.start == 5 && extent.length == 3);
+	CHECK(runs.bestFit(4, &extent) && extent.start == 11 && extent.length == 4);
+	CHECK(!runs.bestFit(5, &extent));
+}
+
+
+
+// ------------------------
+static void testAllocate()	{
+// ------------------------
+	// taking the middle of a run leaves both ends
+	scan("xx........xx");
+	runs.allocate(6, 2);
+	CHECK(runs.count() == 2);
+	CHECK(hasRun(4, 2));
+	CHECK(hasRun(8, 4));
+
+	// a range over several runs cuts all of them
+	runs.allocate(5, 5);
+	CHECK(runs.count() == 2);
+	CHECK(hasRun(4, 1));
+	CHECK(hasRun(10, 2));
+}
+
+
+
+// ------------------------
+static void testRelease()	{
+// ------------------------
+	// a freed range joins the runs it touches on either side
+	scan("..xx..xx..");
+	CHECK(runs.count() == 3);
+	runs.release(4, 2);
+	CHECK(runs.count() == 2);
+	CHECK(hasRun(2, 6));
+
+	runs.release(8, 2);
+	CHECK(runs.count() == 1);
+	CHECK(hasRun(2, 10));
+
+	// allocate and release back gives the run it started with
+	runs.allocate(5, 3);
+	runs.release(5, 3);
+	CHECK(runs.count() == 1);
+	CHECK(hasRun(2, 10));
+}
+
+
+
+// ------------------------
+static void testEviction()	{
+// ------------------------
+	// runs 2+1, 4+2, 7+3, 11+4 fill the index
+	scan(".x..x...x....");
+	CHECK(runs.count() == 4);
+
+	// a longer run pushes out the shortest
+	runs.release(20, 5);
+	CHECK(runs.count() == 4);
+	CHECK(!hasRun(2, 1));
+	FreeExtent extent;
+	CHECK(runs.bestFit(1, &extent) && extent.start == 4 && extent.length == 2);
+	CHECK(runs.largest() == 5);
+
+	// one no longer than the shortest is not kept
+	runs.release(30, 2);
+	CHECK(runs.count() == 4);
+	CHECK(runs.bestFit(1, &extent) && extent.start == 4);
+
+	// the scan evicts the same way
+	scan(".x..x...x....x.....x......");
+	CHECK(runs.count() == 4);
+	CHECK(runs.bestFit(1, &extent) && extent.length == 3);
+	CHECK(runs.largest() == 6);
+}
+
+
+
+// ------------------------
+int main(int, char **argv)	{
+// ------------------------
+	testScan();
+	testBestFit();
+	testAllocate();
+	testRelease();
+	testEviction();
+
+	printf("%s: %d failed\n", argv[0], numFailed);
+	return numFailed ? 1 : 0;
+}
@@ -0,0 +1,187 @@
+// Host test of the gzip compressor: every stream is inflated again with
+// zlib and has to give back the input byte for byte.
+//   ./GzipStreamTest
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <zlib.h>
+#include "GzipStream.h"
+
+static int numFailed = 0;
+
+#define CHECK(cond)	do { if(!(cond))	{ printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); numFailed++; } } while(0)
+
+
+
+// ------------------------
+static void collect(void *ctx, const uint8_t *data, size_t len)	{
+// ------------------------
+	std::string *out = (std::string *) ctx;
+	out->append((const char *) data, len);
+}
+
+
+
+// ------------------------
+static bool gunzip(const std::string &in, std::string *out)	{
+// ------------------------
+	z_stream z;
+	memset(&z, 0, sizeof(z));
+	if(inflateInit2(&z, 16 + MAX_WBITS) != Z_OK)
+		return false;
+
+	z.next_in = (Bytef *) in.data();
+	z.avail_in = in.size();
+	char buf[4096];
+	int ret;
+	do	{
+		z.next_out = (Bytef *) buf;
+		z.avail_out = sizeof(buf);
+		ret = inflate(&z, Z_NO_FLUSH);
+		out->append(buf, sizeof(buf) - z.avail_out);
+	} while(ret == Z_OK);
+
+	// nothing may follow the member
+	bool retVal = (ret == Z_STREAM_END) && z.avail_in == 0;
+	inflateEnd(&z);
+	return retVal;
+}
+
+
+
+// ------------------------
+static bool roundTrip(const char *name, const std::string &input, size_t piece)	{
+// ------------------------
+	// piece: bytes handed to write() at a time
+	std::string gz;
+	GzipStream *gzip = new GzipStream(collect, &gz);
+	for(size_t pos = 0; pos < input.size(); pos += piece)
+		gzip->write((const uint8_t *) input.data() + pos, (input.size() - pos < piece) ? input.size() - pos : piece);
+	gzip->finish();
+
+	bool sizesOk = gzip->inputSize() == input.size() && gzip->outputSize() == gz.size();
+	delete gzip;
+
+	std::string output;
+	bool retVal = sizesOk && gunzip(gz, &output) && output == input;
+	if(!retVal)
+		printf("%s: %u bytes in pieces of %u did not come back\n", name, (unsigned) input.size(), (unsigned) piece);
+	return retVal;
+}
+
+
+
+// ------------------------
+static std::string xmlInput()	{
+// ------------------------
+	// what a PROPFIND of a folder of gcode files looks like
+	std::string xml = "<?xml version=\"1.0\" encoding=\"utf-8\"?><D:multistatus xmlns:D=\"DAV:\">";
+	char entry[512];
+	for(int i = 0; i < 400; i++)	{
+		snprintf(entry, sizeof(entry), "<D:response><D:href>/gcode/part_%04d.gcode</D:href><D:propstat><D:status>HTTP/1.1 200 OK</D:status>"
+			"<D:prop><D:getlastmodified>Mon, %02d Jan 2018 %02d:%02d:00 GMT</D:getlastmodified><D:getcontentlength>%d</D:getcontentlength>"
+			"<D:resourcetype/><D:getcontenttype>application/octet-stream</D:getcontenttype></D:prop></D:propstat></D:response>",
+			i, 1 + i % 28, i % 24, i % 60, 1000 + i * 7919);
+		xml += entry;
+	}
+	return xml + "</D:multistatus>";
+}
+
+
+
+// ------------------------
+static std::string lowEntropyInput()	{
+// ------------------------
+	// long runs and short periods: matches of every length and distance 1
+	std::string data(70000, '\0');
+	data += std::string(300, 'a');
+	for(int i = 0; i < 5000; i++)
+		data += "abc";
+	for(int len = 1; len < 600; len += 37)
+		data += std::string(len, 'x') + "y";
+	return data;
+}
+
+
+
+// ------------------------
+static std::string randomInput(size_t size)	{
+// ------------------------
+	// nothing to match, every byte a literal of 8 or 9 bits
+	std::string data;
+	uint32_t seed = 12345;
+	for(size_t i = 0; i < size; i++)	{
+		seed = seed * 1103515245 + 12345;
+		data += (char) (seed >> 16);
+	}
+	return data;
+}
+
+
+
+// ------------------------
+static void testEmpty()	{
+// ------------------------
+	CHECK(roundTrip("empty", "", 1));
+	CHECK(roundTrip("one byte", "x", 1));
+}
+
+
+
+// ------------------------
+static void testXml()	{
+// ------------------------
+	std::string xml = xmlInput();
+	CHECK(roundTrip("xml", xml, 1));
+	CHECK(roundTrip("xml", xml, 100));
+	CHECK(roundTrip("xml", xml, xml.size()));
+
+	// XML should shrink to well under half
+	std::string gz;
+	GzipStream gzip(collect, &gz);
+	gzip.write((const uint8_t *) xml.data(), xml.size());
+	gzip.finish();
+	CHECK(gz.size() < xml.size() / 2);
+}
+
+
+
+// ------------------------
+static void testLowEntropy()	{
+// ------------------------
+	std::string data = lowEntropyInput();
+	CHECK(roundTrip("low entropy", data, 7));
+	CHECK(roundTrip("low entropy", data, 4096));
+}
+
+
+
+// ------------------------
+static void testRandom()	{
+// ------------------------
+	std::string data = randomInput(50000);
+	CHECK(roundTrip("random", data, 1));
+	CHECK(roundTrip("random", data, 1000));
+
+	// random data with repeats further back than the window
+	std::string mixed = data.substr(0, 3000);
+	mixed += randomInput(2 * DAV_GZIP_WINDOW + 100);
+	mixed += data.substr(0, 3000);
+	CHECK(roundTrip("random repeats", mixed, 512));
+}
+
+
+
+// ------------------------
+int main(int, char **argv)	{
+// ------------------------
+	testEmpty();
+	testXml();
+	testLowEntropy();
+	testRandom();
+
+	printf("%s: %d failed\n", argv[0], numFailed);
+	return numFailed ? 1 : 0;
+}
@@ -0,0 +1,208 @@
+// Host test of the ustar headers: what makeHeader writes has to read back
+// through fullName, size and the checksum, long names and pax paths are
+// parsed or turned away as the extract expects.
+//   ./TarFormatTest
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include "TarFormat.h"
+
+static int numFailed = 0;
+
+#define CHECK(cond)	do { if(!(cond))	{ printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); numFailed++; } } while(0)
+
+#define NAME_BUF	256
+
+
+
+// ------------------------
+static std::string paxRecord(const std::string &keyValue)	{
+// ------------------------
+	// "length key=value\n", the length counts its own digits
+	size_t len = keyValue.length() + 2;
+	size_t numDigits = 1;
+	while(std::to_string(len + numDigits).length() > numDigits)
+		numDigits++;
+	return std::to_string(len + numDigits) + " " + keyValue + "\n";
+}
+
+
+
+// ------------------------
+static void testHeaderSize()	{
+// ------------------------
+	CHECK(sizeof(TarHeader) == TAR_BLOCK);
+}
+
+
+
+// ------------------------
+static void testShortName()	{
+// ------------------------
+	TarHeader h;
+	char name[NAME_BUF];
+	CHECK(TarFormat::makeHeader(&h, "gcode/part.gcode", 123456, 1500000000, TAR_TYPE_FILE));
+	CHECK(TarFormat::checksumOk(&h));
+	CHECK(!TarFormat::isEnd(&h));
+	CHECK(TarFormat::isFile(&h));
+	CHECK(TarFormat::size(&h) == 123456);
+	CHECK(TarFormat::octal(h.mtime, sizeof(h.mtime)) == 1500000000);
+	CHECK(TarFormat::octal(h.mode, sizeof(h.mode)) == 0644);
+	CHECK(!memcmp(h.magic, "ustar", 6) && !memcmp(h.version, "00", 2));
+	CHECK(TarFormat::fullName(&h, name, sizeof(name)) && !strcmp(name, "gcode/part.gcode"));
+
+	CHECK(TarFormat::makeHeader(&h, "gcode/", 0, 0, TAR_TYPE_DIR));
+	CHECK(!TarFormat::isFile(&h));
+	CHECK(TarFormat::octal(h.mode, sizeof(h.mode)) == 0755);
+
+	// a name of exactly 100 bytes fills the field without a NUL
+	std::string full(100, 'n');
+	CHECK(TarFormat::makeHeader(&h, full.c_str(), 1, 0, TAR_TYPE_FILE));
+	CHECK(TarFormat::fullName(&h, name, sizeof(name)) && full == name);
+}
+
+
+
+// ------------------------
+static void testChecksum()	{
+// ------------------------
+	TarHeader h;
+	TarFormat::makeHeader(&h, "a.txt", 10, 0, TAR_TYPE_FILE);
+	h.name[0] = 'b';
+	CHECK(!TarFormat::checksumOk(&h));
+
+	// GNU tar writes the fields with leading spaces and a trailing space
+	TarFormat::makeHeader(&h, "a.txt", 0, 0, TAR_TYPE_OLDFILE);
+	memcpy(h.size, "      1750 ", 11);
+	TarFormat::setChecksum(&h);
+	CHECK(TarFormat::checksumOk(&h));
+	CHECK(TarFormat::isFile(&h));
+	CHECK(TarFormat::size(&h) == 01750);
+
+	// base-256 size, too big for FAT
+	h.size[0] = (char) 0x80;
+	CHECK(TarFormat::size(&h) == 0xFFFFFFFF);
+
+	TarHeader zero;
+	memset(&zero, 0, sizeof(zero));
+	CHECK(TarFormat::isEnd(&zero));
+}
+
+
+
+// ------------------------
+static void testPrefix()	{
+// ------------------------
+	// too long for name alone, split at a slash into prefix and name
+	TarHeader h;
+	char name[NAME_BUF];
+	std::string dir = "projects/" + std::string(80, 'd');
+	std::string path = dir + "/" + std::string(60, 'f') + ".gcode";
+	CHECK(path.length() > 100);
+	CHECK(TarFormat::makeHeader(&h, path.c_str(), 5, 0, TAR_TYPE_FILE));
+	CHECK(TarFormat::checksumOk(&h));
+	CHECK(strnlen(h.prefix, sizeof(h.prefix)) == dir.length());
+	CHECK(TarFormat::fullName(&h, name, sizeof(name)) && path == name);
+
+	// does not fit the buffer: false, cut and terminated
+	char small[32];
+	CHECK(!TarFormat::fullName(&h, small, sizeof(small)));
+	CHECK(strlen(small) == sizeof(small) - 1);
+	CHECK(!strncmp(small, path.c_str(), sizeof(small) - 1));
+}
+
+
+
+// ------------------------
+static void testLongName()	{
+// ------------------------
+	// no slash to split at: the header is cut and a long name member goes first
+	TarHeader h;
+	std::string path(150, 'x');
+	CHECK(!TarFormat::makeHeader(&h, path.c_str(), 5, 0, TAR_TYPE_FILE));
+
+	TarFormat::makeLongName(&h, path.length());
+	CHECK(TarFormat::checksumOk(&h));
+	CHECK(h.typeflag == TAR_TYPE_LONGNAME);
+	CHECK(!strcmp(h.name, TAR_LONGLINK));
+	CHECK(TarFormat::size(&h) == path.length() + 1);
+	CHECK(TarFormat::padding(TarFormat::size(&h)) == TAR_BLOCK - 151);
+
+	// a last part longer than name cannot be split either
+	std::string deep = "dir/" + std::string(120, 'y');
+	CHECK(!TarFormat::makeHeader(&h, deep.c_str(), 5, 0, TAR_TYPE_FILE));
+}
+
+
+
+// ------------------------
+static void testPadding()	{
+// ------------------------
+	CHECK(TarFormat::padding(0) == 0);
+	CHECK(TarFormat::padding(1) == 511);
+	CHECK(TarFormat::padding(512) == 0);
+	CHECK(TarFormat::padding(513) == 511);
+}
+
+
+
+// ------------------------
+static void testPaxPath()	{
+// ------------------------
+	char name[NAME_BUF];
+	bool tooLong = false;
+
+	std::string data = paxRecord("mtime=1500000000.5") + paxRecord("path=gcode/a very long name.gcode") + paxRecord("size=12");
+	CHECK(TarFormat::paxPath(data.data(), data.length(), name, sizeof(name), &tooLong));
+	CHECK(!tooLong && !strcmp(name, "gcode/a very long name.gcode"));
+
+	// no path record
+	data = paxRecord("mtime=1") + paxRecord("uid=1000");
+	tooLong = false;
+	CHECK(!TarFormat::paxPath(data.data(), data.length(), name, sizeof(name), &tooLong));
+	CHECK(!tooLong);
+
+	// a path longer than the buffer is refused, not cut
+	std::string longPath(NAME_BUF, 'p');
+	data = paxRecord("path=" + longPath);
+	tooLong = false;
+	CHECK(!TarFormat::paxPath(data.data(), data.length(), name, sizeof(name), &tooLong));
+	CHECK(tooLong);
+
+	// exactly one byte short of the buffer still fits
+	std::string fitPath(NAME_BUF - 1, 'q');
+	data = paxRecord("path=" + fitPath);
+	tooLong = false;
+	CHECK(TarFormat::paxPath(data.data(), data.length(), name, sizeof(name), &tooLong));
+	CHECK(!tooLong && fitPath == name);
+
+	// a record running past the data seen may be the path
+	data = paxRecord("path=gcode/cut.gcode");
+	tooLong = false;
+	CHECK(!TarFormat::paxPath(data.data(), data.length() - 4, name, sizeof(name), &tooLong));
+	CHECK(tooLong);
+
+	// garbage
+	data = "x path=a\n";
+	tooLong = false;
+	CHECK(!TarFormat::paxPath(data.data(), data.length(), name, sizeof(name), &tooLong));
+	CHECK(!tooLong);
+}
+
+
+
+// ------------------------
+int main(int, char **argv)	{
+// ------------------------
+	testHeaderSize();
+	testShortName();
+	testChecksum();
+	testPrefix();
+	testLongName();
+	testPadding();
+	testPaxPath();
+
+	printf("%s: %d failed\n", argv[0], numFailed);
+	return numFailed ? 1 : 0;
+}
@@ -0,0 +1,139 @@
+// Host test of the upload digests against published known answers, with
+// the input cut into pieces the way it arrives from the socket. Builds
+// against the small String and MD5Builder stand-ins in stubs/.
+//   ./UploadDigestTest
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include "UploadDigest.h"
+
+static int numFailed = 0;
+
+#define CHECK(cond)	do { if(!(cond))	{ printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); numFailed++; } } while(0)
+
+
+
+// ------------------------
+static std::string digest(DigestType type, const std::string &input, size_t piece)	{
+// ------------------------
+	// piece: bytes handed to update() at a time
+	UploadDigest d;
+	d.begin(type);
+	for(size_t pos = 0; pos < input.size(); pos += piece)
+		d.update((const uint8_t *) input.data() + pos, (input.size() - pos < piece) ? input.size() - pos : piece);
+	return d.finish().c_str();
+}
+
+
+
+// ------------------------
+static void testSha256()	{
+// ------------------------
+	// FIPS 180-2 examples, base64 of the digest
+	CHECK(digest(DIGEST_SHA256, "abc", 3) == "ungWv48Bz+pBQUDeXa4iI7ADYaOWF3qctBD/YfIAFa0=");
+	CHECK(digest(DIGEST_SHA256, "", 1) == "47DEQpj8HBSa+/TImW+5JCeuQeRkm5NMpJWZG3hSuFU=");
+	CHECK(digest(DIGEST_SHA256, "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", 56) == "JI1qYdIGOLjlwCaTDD5gOaM85Flk/yFn9uzt1BnbBsE=");
+
+	std::string million(1000000, 'a');
+	CHECK(digest(DIGEST_SHA256, million, million.size()) == "zcduXJkU+5KBocfihNc+Z/GAmkiklyAOBG05zMcRLNA=");
+	CHECK(digest(DIGEST_SHA256, million, 512) == "zcduXJkU+5KBocfihNc+Z/GAmkiklyAOBG05zMcRLNA=");
+}
+
+
+
+// ------------------------
+static void testSha256Padding()	{
+// ------------------------
+	// 55 bytes pad in the same block, 56 to 64 need a second one
+	const char *expected[] = {
+		"n0OQ+NMMLdkuyfCVtl4rmumwqSWlJY4kHJ8ekQ9zQxg=",	// 55
+		"s1Q5pKxvCUi21vnjxq8PX1kM4g8b3nCQ73lwaG7Gc4o=",	// 56
+		"/+BU/nrgy23GXDr5th1SCfQ5hR20PQulmXM33xVGaOs=",	// 64
+	};
+	size_t lengths[] = { 55, 56, 64 };
+	for(int i = 0; i < 3; i++)	{
+		std::string input(lengths[i], 'a');
+		CHECK(digest(DIGEST_SHA256, input, input.size()) == expected[i]);
+	}
+}
+
+
+
+// ------------------------
+static void testCrc32c()	{
+// ------------------------
+	// check value 0xE3069283, big endian
+	CHECK(digest(DIGEST_CRC32C, "123456789", 9) == "4waSgw==");
+	CHECK(digest(DIGEST_CRC32C, "", 1) == "AAAAAA==");
+}
+
+
+
+// ------------------------
+static void testSplit()	{
+// ------------------------
+	// any cut of the input gives the digest of the whole
+	std::string input;
+	uint32_t seed = 12345;
+	for(int i = 0; i < 5000; i++)	{
+		seed = seed * 1103515245 + 12345;
+		input += (char) (seed >> 16);
+	}
+
+	std::string sha = digest(DIGEST_SHA256, input, input.size());
+	std::string crc = digest(DIGEST_CRC32C, input, input.size());
+	size_t pieces[] = { 1, 3, 55, 63, 64, 65, 100, 1460 };
+	for(size_t i = 0; i < sizeof(pieces) / sizeof(pieces[0]); i++)	{
+		CHECK(digest(DIGEST_SHA256, input, pieces[i]) == sha);
+		CHECK(digest(DIGEST_CRC32C, input, pieces[i]) == crc);
+	}
+}
+
+
+
+// ------------------------
+static void testBase64()	{
+// ------------------------
+	// RFC 4648 test vectors
+	const char *plain[] = { "", "f", "fo", "foo", "foob", "fooba", "foobar" };
+	const char *encoded[] = { "", "Zg==", "Zm8=", "Zm9v", "Zm9vYg==", "Zm9vYmE=", "Zm9vYmFy" };
+	for(int i = 0; i < 7; i++)
+		CHECK(!strcmp(UploadDigest::base64((const uint8_t *) plain[i], strlen(plain[i])).c_str(), encoded[i]));
+}
+
+
+
+// ------------------------
+static void testNames()	{
+// ------------------------
+	CHECK(UploadDigest::parseName("SHA-256") == DIGEST_SHA256);
+	CHECK(UploadDigest::parseName("md5") == DIGEST_MD5);
+	CHECK(UploadDigest::parseName("CRC32C") == DIGEST_CRC32C);
+	CHECK(UploadDigest::parseName("sha-512") == DIGEST_NONE);
+	CHECK(!strcmp(UploadDigest::name(DIGEST_SHA256), "sha-256"));
+	CHECK(!strcmp(UploadDigest::name(DIGEST_CRC32C), "crc32c"));
+
+	// finish ends the digest
+	UploadDigest d;
+	d.begin(DIGEST_CRC32C);
+	CHECK(d.isActive());
+	d.finish();
+	CHECK(!d.isActive());
+}
+
+
+
+// ------------------------
+int main(int, char **argv)	{
+// ------------------------
+	testSha256();
+	testSha256Padding();
+	testCrc32c();
+	testSplit();
+	testBase64();
+	testNames();
+
+	printf("%s: %d failed\n", argv[0], numFailed);
+	return numFailed ? 1 : 0;
+}
@@ -0,0 +1,30 @@
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+// The part of the Arduino core that host tests of core dependent files
+// need: a String over std::string.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <string>
+
+
+class String	{
+public:
+	String()	{}
+	String(const char *text) : str(text)	{}
+	void reserve(size_t size)	{ str.reserve(size); }
+	String& operator+=(char c)	{ str += c; return *this; }
+	String& operator+=(const char *text)	{ str += text; return *this; }
+	bool equals(const char *text) const	{ return str == text; }
+	bool equalsIgnoreCase(const String& other) const	{ return strcasecmp(str.c_str(), other.c_str()) == 0; }
+	unsigned int length() const	{ return str.length(); }
+	const char *c_str() const	{ return str.c_str(); }
+
+private:
+	std::string str;
+};
+
+#endif